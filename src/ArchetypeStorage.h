@@ -0,0 +1,446 @@
+#pragma once
+
+#include "ECSTypes.h"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// Alternative component storage: entities sharing a Signature live in the same archetype,
+// packed into fixed-size chunks. Inside a chunk every component is a contiguous column, so
+// iterating several components of the same entities is a sequential walk over memory.
+class ArchetypeStorage
+{
+public:
+    static constexpr std::size_t CHUNK_SIZE = 16 * 1024;
+
+    ArchetypeStorage()
+    {
+        root_ = get_or_create_archetype(Signature{});
+    }
+
+    ArchetypeStorage(const ArchetypeStorage &) = delete;
+    ArchetypeStorage &operator=(const ArchetypeStorage &) = delete;
+
+    ~ArchetypeStorage()
+    {
+        for (const auto &archetype : archetypes_)
+        {
+            for (const auto &chunk : archetype->chunks)
+            {
+                destroy_rows(*archetype, *chunk, 0, chunk->count);
+            }
+        }
+    }
+
+    template<class T>
+    void registerComponent()
+    {
+        const std::size_t id = get_component_id<T>();
+        if (id >= component_types_.size())
+        {
+            component_types_.resize(id + 1, INVALID_COMPONENT_TYPE);
+        }
+        assert(component_types_[id] == INVALID_COMPONENT_TYPE);
+        assert(next_component_type_ < MAX_COMPONENTS);
+
+        ColumnInfo &info = column_infos_[next_component_type_];
+        info.size = sizeof(T);
+        info.align = alignof(T);
+        info.relocate = [](void *dst, void *src) {
+            new (dst) T(std::move(*static_cast<T *>(src)));
+            static_cast<T *>(src)->~T();
+        };
+        info.destroy = [](void *ptr) { static_cast<T *>(ptr)->~T(); };
+
+        component_types_[id] = next_component_type_;
+        next_component_type_++;
+    }
+
+    template<class T>
+    [[nodiscard]] ComponentType getComponentType() const
+    {
+        const std::size_t id = get_component_id<T>();
+        assert(id < component_types_.size() && component_types_[id] != INVALID_COMPONENT_TYPE);
+        return component_types_[id];
+    }
+
+    template<class... Comps>
+    [[nodiscard]] Signature getSignature() const
+    {
+        Signature signature;
+        (signature.set(getComponentType<Comps>()), ...);
+        return signature;
+    }
+
+    // The entity handle must come from an EntityManager; it starts in the empty archetype.
+    void entityCreated(Entity entity)
+    {
+        const std::uint32_t index = entityIndex(entity);
+        if (index >= records_.size())
+        {
+            records_.resize(index + 1);
+        }
+        assert(records_[index].archetype == nullptr);
+        records_[index] = allocate_row(*root_, entity);
+    }
+
+    void entityDestroyed(Entity entity)
+    {
+        Record &record = get_record(entity);
+        free_row(record);
+        record = Record{};
+    }
+
+    template<class T>
+    void addComponent(Entity entity, T component)
+    {
+        const ComponentType type = getComponentType<T>();
+        Record &record = get_record(entity);
+        assert(!record.archetype->signature.test(type));
+
+        Archetype *target = record.archetype->add_edges[type];
+        if (target == nullptr)
+        {
+            Signature signature = record.archetype->signature;
+            signature.set(type);
+            target = get_or_create_archetype(signature);
+            record.archetype->add_edges[type] = target;
+            target->remove_edges[type] = record.archetype;
+        }
+
+        const Record new_record = move_entity(record, *target);
+        Chunk &chunk = *target->chunks[new_record.chunk];
+        new (column_ptr(*target, chunk, type, new_record.row)) T(std::move(component));
+        record = new_record;
+    }
+
+    template<class T>
+    void removeComponent(Entity entity)
+    {
+        const ComponentType type = getComponentType<T>();
+        Record &record = get_record(entity);
+        assert(record.archetype->signature.test(type));
+
+        Archetype *target = record.archetype->remove_edges[type];
+        if (target == nullptr)
+        {
+            Signature signature = record.archetype->signature;
+            signature.reset(type);
+            target = get_or_create_archetype(signature);
+            record.archetype->remove_edges[type] = target;
+            target->add_edges[type] = record.archetype;
+        }
+
+        record = move_entity(record, *target);
+    }
+
+    template<class T>
+    [[nodiscard]] bool hasComponent(Entity entity) const
+    {
+        const std::uint32_t index = entityIndex(entity);
+        return index < records_.size() && records_[index].archetype
+            && records_[index].archetype->signature.test(getComponentType<T>());
+    }
+
+    template<class T>
+    [[nodiscard]] T &getComponent(Entity entity)
+    {
+        const ComponentType type = getComponentType<T>();
+        Record &record = get_record(entity);
+        assert(record.archetype->signature.test(type));
+        Chunk &chunk = *record.archetype->chunks[record.chunk];
+        return *static_cast<T *>(column_ptr(*record.archetype, chunk, type, record.row));
+    }
+
+    // Calls func(count, entities, Comps*...) once per chunk of every archetype that has all
+    // of Comps; each pointer addresses a contiguous column of `count` elements.
+    template<class... Comps, class F>
+    void forEachChunk(F &&func)
+    {
+        const Signature signature = getSignature<Comps...>();
+        const std::array<ComponentType, sizeof...(Comps)> types{getComponentType<Comps>()...};
+
+        for (const auto &archetype : archetypes_)
+        {
+            if ((archetype->signature & signature) != signature)
+            {
+                continue;
+            }
+            for (const auto &chunk : archetype->chunks)
+            {
+                call_with_columns<Comps...>(func, *archetype, *chunk, types,
+                    std::index_sequence_for<Comps...>{});
+            }
+        }
+    }
+
+    // Calls func(entity, Comps &...) for every entity that has all of Comps, chunk by chunk.
+    template<class... Comps, class F>
+    void forEach(F &&func)
+    {
+        forEachChunk<Comps...>([&func](std::uint32_t count, const Entity *entities,
+                                   Comps *...columns) {
+            for (std::uint32_t i = 0; i < count; ++i)
+            {
+                func(entities[i], columns[i]...);
+            }
+        });
+    }
+
+    // Number of entities that have all of Comps.
+    template<class... Comps>
+    [[nodiscard]] std::size_t getCount() const
+    {
+        const Signature signature = getSignature<Comps...>();
+        std::size_t count = 0;
+        for (const auto &archetype : archetypes_)
+        {
+            if ((archetype->signature & signature) == signature)
+            {
+                for (const auto &chunk : archetype->chunks)
+                {
+                    count += chunk->count;
+                }
+            }
+        }
+        return count;
+    }
+
+    [[nodiscard]] std::size_t getArchetypeCount() const { return archetypes_.size(); }
+
+private:
+    struct ColumnInfo
+    {
+        std::size_t size{0};
+        std::size_t align{1};
+        // move-constructs dst from src and destroys src
+        void (*relocate)(void *dst, void *src){nullptr};
+        void (*destroy)(void *ptr){nullptr};
+    };
+
+    struct Chunk
+    {
+        alignas(64) std::byte data[CHUNK_SIZE];
+        std::uint32_t count{0};
+    };
+
+    struct Archetype
+    {
+        Signature signature;
+        std::uint32_t capacity{0};
+        // byte offset of each component column inside a chunk; entities start at offset 0
+        std::array<std::size_t, MAX_COMPONENTS> column_offsets{};
+        std::vector<ComponentType> types;
+        std::vector<std::unique_ptr<Chunk>> chunks;
+        // the last chunk that ran empty, kept so that entities passing through the archetype
+        // one at a time do not allocate and free a chunk each
+        std::unique_ptr<Chunk> spare;
+        std::array<Archetype *, MAX_COMPONENTS> add_edges{};
+        std::array<Archetype *, MAX_COMPONENTS> remove_edges{};
+    };
+
+    struct Record
+    {
+        Archetype *archetype{nullptr};
+        std::uint32_t chunk{0};
+        std::uint32_t row{0};
+    };
+
+    static constexpr ComponentType INVALID_COMPONENT_TYPE = ~ComponentType{0};
+
+    template<class T>
+    static inline std::size_t get_component_id()
+    {
+        return TypeId<ComponentFamily>::get<T>();
+    }
+
+    Record &get_record(Entity entity)
+    {
+        const std::uint32_t index = entityIndex(entity);
+        assert(index < records_.size() && records_[index].archetype);
+        Record &record = records_[index];
+        assert(entities_of(*record.archetype->chunks[record.chunk])[record.row] == entity);
+        return record;
+    }
+
+    static inline Entity *entities_of(Chunk &chunk)
+    {
+        return reinterpret_cast<Entity *>(chunk.data);
+    }
+
+    void *column_ptr(const Archetype &archetype, Chunk &chunk, ComponentType type,
+        std::uint32_t row) const
+    {
+        return chunk.data + archetype.column_offsets[type] + row * column_infos_[type].size;
+    }
+
+    template<class... Comps, class F, std::size_t... I>
+    void call_with_columns(F &func, const Archetype &archetype, Chunk &chunk,
+        const std::array<ComponentType, sizeof...(Comps)> &types, std::index_sequence<I...>)
+    {
+        func(chunk.count, static_cast<const Entity *>(entities_of(chunk)),
+            static_cast<Comps *>(column_ptr(archetype, chunk, types[I], 0))...);
+    }
+
+    Archetype *get_or_create_archetype(Signature signature)
+    {
+        auto it = archetype_index_.find(signature);
+        if (it != archetype_index_.end())
+        {
+            return it->second;
+        }
+
+        auto archetype = std::make_unique<Archetype>();
+        archetype->signature = signature;
+        std::size_t row_size = sizeof(Entity);
+        for (ComponentType type = 0; type < MAX_COMPONENTS; ++type)
+        {
+            if (signature.test(type))
+            {
+                archetype->types.push_back(type);
+                row_size += column_infos_[type].size;
+            }
+        }
+
+        // shrink the capacity until the columns fit together with their alignment padding
+        std::uint32_t capacity = CHUNK_SIZE / row_size;
+        while (!layout_columns(*archetype, capacity))
+        {
+            capacity--;
+        }
+        assert(capacity > 0);
+        archetype->capacity = capacity;
+
+        Archetype *result = archetype.get();
+        archetypes_.push_back(std::move(archetype));
+        archetype_index_.emplace(signature, result);
+        return result;
+    }
+
+    bool layout_columns(Archetype &archetype, std::uint32_t capacity) const
+    {
+        std::size_t offset = capacity * sizeof(Entity);
+        for (const ComponentType type : archetype.types)
+        {
+            const ColumnInfo &info = column_infos_[type];
+            offset = (offset + info.align - 1) / info.align * info.align;
+            archetype.column_offsets[type] = offset;
+            offset += capacity * info.size;
+        }
+        return offset <= CHUNK_SIZE;
+    }
+
+    // Appends an uninitialized row for the entity to the last chunk of the archetype.
+    static Record allocate_row(Archetype &archetype, Entity entity)
+    {
+        if (archetype.chunks.empty() || archetype.chunks.back()->count == archetype.capacity)
+        {
+            archetype.chunks.push_back(
+                archetype.spare ? std::move(archetype.spare) : std::make_unique<Chunk>());
+        }
+        const auto chunk_index = static_cast<std::uint32_t>(archetype.chunks.size() - 1);
+        Chunk &chunk = *archetype.chunks.back();
+        const std::uint32_t row = chunk.count++;
+        entities_of(chunk)[row] = entity;
+        return Record{&archetype, chunk_index, row};
+    }
+
+    // Moves the entity's components into a new row of the target archetype, destroys the
+    // components the target does not have and frees the old row.
+    Record move_entity(const Record &record, Archetype &target)
+    {
+        Archetype &source = *record.archetype;
+        Chunk &src_chunk = *source.chunks[record.chunk];
+        const Entity entity = entities_of(src_chunk)[record.row];
+
+        const Record new_record = allocate_row(target, entity);
+        Chunk &dst_chunk = *target.chunks[new_record.chunk];
+        for (const ComponentType type : source.types)
+        {
+            void *src = column_ptr(source, src_chunk, type, record.row);
+            if (target.signature.test(type))
+            {
+                void *dst = column_ptr(target, dst_chunk, type, new_record.row);
+                column_infos_[type].relocate(dst, src);
+            }
+            else
+            {
+                column_infos_[type].destroy(src);
+            }
+        }
+
+        fill_hole(record);
+        return new_record;
+    }
+
+    void free_row(const Record &record)
+    {
+        Chunk &chunk = *record.archetype->chunks[record.chunk];
+        destroy_rows(*record.archetype, chunk, record.row, record.row + 1);
+        fill_hole(record);
+    }
+
+    // Keeps the archetype packed: the last row of its last chunk moves into the freed row,
+    // whose components must already be relocated or destroyed.
+    void fill_hole(const Record &hole)
+    {
+        Archetype &archetype = *hole.archetype;
+        Chunk &last_chunk = *archetype.chunks.back();
+        const auto last_chunk_index = static_cast<std::uint32_t>(archetype.chunks.size() - 1);
+        const std::uint32_t last_row = last_chunk.count - 1;
+
+        if (hole.chunk != last_chunk_index || hole.row != last_row)
+        {
+            Chunk &chunk = *archetype.chunks[hole.chunk];
+            for (const ComponentType type : archetype.types)
+            {
+                column_infos_[type].relocate(column_ptr(archetype, chunk, type, hole.row),
+                    column_ptr(archetype, last_chunk, type, last_row));
+            }
+            const Entity moved = entities_of(last_chunk)[last_row];
+            entities_of(chunk)[hole.row] = moved;
+            records_[entityIndex(moved)] = hole;
+        }
+
+        last_chunk.count--;
+        if (last_chunk.count == 0)
+        {
+            archetype.spare = std::move(archetype.chunks.back());
+            archetype.chunks.pop_back();
+        }
+    }
+
+    void destroy_rows(const Archetype &archetype, Chunk &chunk, std::uint32_t begin,
+        std::uint32_t end) const
+    {
+        for (const ComponentType type : archetype.types)
+        {
+            for (std::uint32_t row = begin; row < end; ++row)
+            {
+                column_infos_[type].destroy(column_ptr(archetype, chunk, type, row));
+            }
+        }
+    }
+
+private:
+    std::array<ColumnInfo, MAX_COMPONENTS> column_infos_{};
+    // indexed by TypeId<ComponentFamily>
+    std::vector<ComponentType> component_types_;
+    ComponentType next_component_type_ = 0;
+
+    std::vector<std::unique_ptr<Archetype>> archetypes_;
+    std::unordered_map<Signature, Archetype *> archetype_index_;
+    Archetype *root_{nullptr};
+
+    // indexed by entityIndex()
+    std::vector<Record> records_;
+};
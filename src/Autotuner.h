@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace Tuning
+{
+
+// Picks the fastest of a list of configurations whose error stays within a budget.
+// The caller measures one candidate at a time, typically one per frame on the live data, and
+// records its time and error. Once every candidate is measured the best one is kept until the
+// problem size drifts from the tuned size by more than the retune factor.
+template<class Config>
+class Autotuner
+{
+public:
+    struct Trial
+    {
+        Config config;
+        double ms{0.0};
+        double error{0.0};
+        bool measured{false};
+    };
+
+    // Largest acceptable error; if no candidate meets it, the most accurate one wins.
+    void setAccuracyBudget(double budget)
+    {
+        assert(budget >= 0.0);
+        budget_ = budget;
+    }
+    [[nodiscard]] double getAccuracyBudget() const { return budget_; }
+
+    // Size ratio, either way, past which needsRetune reports true.
+    void setRetuneFactor(double factor)
+    {
+        assert(factor > 1.0);
+        retune_factor_ = factor;
+    }
+    [[nodiscard]] double getRetuneFactor() const { return retune_factor_; }
+
+    // Starts a round over candidates for a problem of the given size.
+    void start(std::vector<Config> candidates, std::size_t size)
+    {
+        assert(size > 0);
+        trials_.clear();
+        for (Config &config : candidates)
+        {
+            trials_.push_back(Trial{std::move(config)});
+        }
+        next_ = 0;
+        best_ = NONE;
+        tuned_size_ = size;
+        started_ = true;
+    }
+
+    // Forgets the last result, so that the next needsRetune reports true.
+    void reset()
+    {
+        trials_.clear();
+        next_ = 0;
+        best_ = NONE;
+        started_ = false;
+    }
+
+    [[nodiscard]] bool isTuning() const { return next_ < trials_.size(); }
+
+    [[nodiscard]] bool needsRetune(std::size_t size) const
+    {
+        if (!started_)
+        {
+            return true;
+        }
+        const auto ratio = static_cast<double>(size) / static_cast<double>(tuned_size_);
+        return ratio > retune_factor_ || ratio * retune_factor_ < 1.0;
+    }
+
+    // The candidate to measure next; only while tuning.
+    [[nodiscard]] const Config &getCandidate() const
+    {
+        assert(isTuning());
+        return trials_[next_].config;
+    }
+
+    void record(double ms, double error)
+    {
+        assert(isTuning());
+        Trial &trial = trials_[next_];
+        trial.ms = ms;
+        trial.error = error;
+        trial.measured = true;
+        if (best_ == NONE || better(trial, trials_[best_]))
+        {
+            best_ = next_;
+        }
+        next_++;
+    }
+
+    // Moves past the current candidate without measuring it.
+    void skip()
+    {
+        assert(isTuning());
+        next_++;
+    }
+
+    [[nodiscard]] bool hasBest() const { return best_ != NONE; }
+    [[nodiscard]] const Trial &getBest() const
+    {
+        assert(hasBest());
+        return trials_[best_];
+    }
+    // Time of the best candidate so far, or infinity.
+    [[nodiscard]] double getBestMs() const
+    {
+        return hasBest() ? trials_[best_].ms : std::numeric_limits<double>::infinity();
+    }
+
+    [[nodiscard]] const std::vector<Trial> &getTrials() const { return trials_; }
+    [[nodiscard]] std::size_t getTunedSize() const { return tuned_size_; }
+
+private:
+    static constexpr std::size_t NONE = std::numeric_limits<std::size_t>::max();
+
+    [[nodiscard]] bool better(const Trial &trial, const Trial &best) const
+    {
+        const bool within = trial.error <= budget_;
+        const bool best_within = best.error <= budget_;
+        if (within != best_within)
+        {
+            return within;
+        }
+        return within ? trial.ms < best.ms : trial.error < best.error;
+    }
+
+private:
+    double budget_{1e-2};
+    double retune_factor_{4.0};
+
+    std::vector<Trial> trials_;
+    std::size_t next_{0};
+    std::size_t best_{NONE};
+    std::size_t tuned_size_{0};
+    bool started_{false};
+};
+
+} // namespace Tuning
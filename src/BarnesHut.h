@@ -0,0 +1,425 @@
+#pragma once
+
+#include "Gravity.h"
+#include "Morton.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Gravity
+{
+
+// Barnes-Hut quadtree over Morton-sorted bodies.
+// build() sorts the bodies along a Z-curve and derives the tree topology from the sorted codes;
+// refit() keeps the topology and only recomputes masses, centers of mass and bounds, which is
+// enough while the bodies have not moved far from where the tree was built.
+class BarnesHutTree
+{
+public:
+    static constexpr std::uint32_t LEAF_SIZE = 8;
+
+    void setOpeningAngle(double theta) { theta_ = theta; }
+    [[nodiscard]] double getOpeningAngle() const { return theta_; }
+
+    [[nodiscard]] bool isBuilt() const { return !nodes_.empty(); }
+    [[nodiscard]] std::size_t getBodyCount() const { return order_.size(); }
+
+    void build(const Bodies &bodies)
+    {
+        nodes_.clear();
+        leaves_.clear();
+        order_.clear();
+        const std::size_t count = bodies.size();
+        if (count == 0)
+        {
+            return;
+        }
+
+        sort_by_morton_code(bodies);
+        build_topology();
+        refit(bodies);
+    }
+
+    void refit(const Bodies &bodies)
+    {
+        assert(bodies.size() == order_.size());
+
+        Parallel::forEach(
+            leaves_.size(), [&](std::size_t i) { refit_leaf(nodes_[leaves_[i]], bodies); }, 64);
+
+        // children always follow their parent, so a reverse pass visits them first
+        for (std::size_t i = nodes_.size(); i-- > 0;)
+        {
+            Node &node = nodes_[i];
+            if (!node.isLeaf())
+            {
+                refit_internal(node);
+            }
+        }
+    }
+
+    void computeAccelerations(const Bodies &bodies, const Params &params,
+        Accelerations &acc) const
+    {
+        assert(bodies.size() == order_.size());
+        acc.reset(bodies.size());
+        if (nodes_.empty())
+        {
+            return;
+        }
+
+        Parallel::forEach(bodies.size(), [&](std::size_t i) {
+            double acc_x = 0.0;
+            double acc_y = 0.0;
+            accumulate(bodies, params, bodies.x[i], bodies.y[i], acc_x, acc_y);
+            acc.x[i] = acc_x * params.gravity;
+            acc.y[i] = acc_y * params.gravity;
+        });
+    }
+
+    // Accelerations at target_count arbitrary points due to the bodies the tree was built or
+    // refitted with. Bodies that coincide with a target are ignored, like the body itself in
+    // computeAccelerations().
+    void computeAccelerationsAt(const Bodies &bodies, const double *target_x,
+        const double *target_y, std::size_t target_count, const Params &params,
+        Accelerations &acc) const
+    {
+        assert(bodies.size() == order_.size());
+        acc.reset(target_count);
+        if (nodes_.empty())
+        {
+            return;
+        }
+
+        Parallel::forEach(target_count, [&](std::size_t i) {
+            double acc_x = 0.0;
+            double acc_y = 0.0;
+            accumulate(bodies, params, target_x[i], target_y[i], acc_x, acc_y);
+            acc.x[i] = acc_x * params.gravity;
+            acc.y[i] = acc_y * params.gravity;
+        });
+    }
+
+private:
+    struct Node
+    {
+        double mass{0.0};
+        double com_x{0.0};
+        double com_y{0.0};
+        double min_x{0.0};
+        double min_y{0.0};
+        double max_x{0.0};
+        double max_y{0.0};
+        // range in order_ covered by this node
+        std::uint32_t begin{0};
+        std::uint32_t end{0};
+        std::array<std::int32_t, 4> children{-1, -1, -1, -1};
+
+        [[nodiscard]] bool isLeaf() const
+        {
+            return children[0] < 0 && children[1] < 0 && children[2] < 0 && children[3] < 0;
+        }
+    };
+
+    // depth at which subtrees are handed to worker threads (4^depth tasks at most)
+    static constexpr std::uint32_t PARALLEL_DEPTH = 3;
+    static constexpr std::uint32_t MAX_LEVEL = 16;
+
+    struct SubtreeTask
+    {
+        std::int32_t parent;
+        std::uint32_t slot;
+        std::uint32_t begin;
+        std::uint32_t end;
+        std::uint32_t level;
+        std::vector<Node> nodes;
+    };
+
+    void sort_by_morton_code(const Bodies &bodies)
+    {
+        sortByMortonCode(bodies.x.data(), bodies.y.data(), bodies.size(), keys_);
+
+        order_.resize(keys_.size());
+        for (std::size_t i = 0; i < keys_.size(); ++i)
+        {
+            order_[i] = static_cast<std::uint32_t>(keys_[i]);
+        }
+    }
+
+    [[nodiscard]] std::uint32_t quadrant_of(std::uint32_t position, std::uint32_t level) const
+    {
+        const auto code = static_cast<std::uint32_t>(keys_[position] >> 32);
+        return code >> (2 * (MAX_LEVEL - 1 - level)) & 3;
+    }
+
+    // Splits [begin, end) into the four child ranges of a node at the given level.
+    [[nodiscard]] std::array<std::uint32_t, 5> split_range(std::uint32_t begin, std::uint32_t end,
+        std::uint32_t level) const
+    {
+        std::array<std::uint32_t, 5> bounds{begin, begin, begin, begin, end};
+        for (std::uint32_t quadrant = 1; quadrant < 4; ++quadrant)
+        {
+            std::uint32_t lo = bounds[quadrant - 1];
+            std::uint32_t hi = end;
+            while (lo < hi)
+            {
+                const std::uint32_t mid = lo + (hi - lo) / 2;
+                if (quadrant_of(mid, level) < quadrant)
+                {
+                    lo = mid + 1;
+                }
+                else
+                {
+                    hi = mid;
+                }
+            }
+            bounds[quadrant] = lo;
+        }
+        return bounds;
+    }
+
+    [[nodiscard]] bool is_leaf_range(std::uint32_t begin, std::uint32_t end,
+        std::uint32_t level) const
+    {
+        return end - begin <= LEAF_SIZE || level >= MAX_LEVEL;
+    }
+
+    // Serial pre-order build of the subtree covering [begin, end); returns its root index.
+    std::int32_t build_subtree(std::vector<Node> &nodes, std::uint32_t begin, std::uint32_t end,
+        std::uint32_t level) const
+    {
+        const auto index = static_cast<std::int32_t>(nodes.size());
+        nodes.emplace_back();
+        nodes[index].begin = begin;
+        nodes[index].end = end;
+        if (is_leaf_range(begin, end, level))
+        {
+            return index;
+        }
+
+        const std::array<std::uint32_t, 5> bounds = split_range(begin, end, level);
+        for (std::uint32_t quadrant = 0; quadrant < 4; ++quadrant)
+        {
+            if (bounds[quadrant] != bounds[quadrant + 1])
+            {
+                const std::int32_t child =
+                    build_subtree(nodes, bounds[quadrant], bounds[quadrant + 1], level + 1);
+                nodes[index].children[quadrant] = child;
+            }
+        }
+        return index;
+    }
+
+    // Builds the top PARALLEL_DEPTH levels serially and the subtrees below them in parallel.
+    void build_topology()
+    {
+        std::vector<SubtreeTask> tasks;
+        build_top(0, static_cast<std::uint32_t>(order_.size()), 0, -1, 0, tasks);
+
+        Parallel::forEach(
+            tasks.size(),
+            [&](std::size_t i) {
+                SubtreeTask &task = tasks[i];
+                build_subtree(task.nodes, task.begin, task.end, task.level);
+            },
+            1);
+
+        for (SubtreeTask &task : tasks)
+        {
+            const auto offset = static_cast<std::int32_t>(nodes_.size());
+            for (Node &node : task.nodes)
+            {
+                for (std::int32_t &child : node.children)
+                {
+                    if (child >= 0)
+                    {
+                        child += offset;
+                    }
+                }
+            }
+            nodes_[task.parent].children[task.slot] = offset;
+            nodes_.insert(nodes_.end(), task.nodes.begin(), task.nodes.end());
+        }
+
+        for (std::size_t i = 0; i < nodes_.size(); ++i)
+        {
+            if (nodes_[i].isLeaf())
+            {
+                leaves_.push_back(static_cast<std::uint32_t>(i));
+            }
+        }
+    }
+
+    void build_top(std::uint32_t begin, std::uint32_t end, std::uint32_t level,
+        std::int32_t parent, std::uint32_t slot, std::vector<SubtreeTask> &tasks)
+    {
+        if (level == PARALLEL_DEPTH && !is_leaf_range(begin, end, level))
+        {
+            tasks.push_back(SubtreeTask{parent, slot, begin, end, level, {}});
+            return;
+        }
+
+        const auto index = static_cast<std::int32_t>(nodes_.size());
+        nodes_.emplace_back();
+        nodes_[index].begin = begin;
+        nodes_[index].end = end;
+        if (parent >= 0)
+        {
+            nodes_[parent].children[slot] = index;
+        }
+        if (is_leaf_range(begin, end, level))
+        {
+            return;
+        }
+
+        const std::array<std::uint32_t, 5> bounds = split_range(begin, end, level);
+        for (std::uint32_t quadrant = 0; quadrant < 4; ++quadrant)
+        {
+            if (bounds[quadrant] != bounds[quadrant + 1])
+            {
+                build_top(bounds[quadrant], bounds[quadrant + 1], level + 1, index, quadrant,
+                    tasks);
+            }
+        }
+    }
+
+    void refit_leaf(Node &node, const Bodies &bodies) const
+    {
+        node.mass = 0.0;
+        node.com_x = 0.0;
+        node.com_y = 0.0;
+        node.min_x = node.min_y = std::numeric_limits<double>::max();
+        node.max_x = node.max_y = std::numeric_limits<double>::lowest();
+        for (std::uint32_t k = node.begin; k < node.end; ++k)
+        {
+            const std::uint32_t body = order_[k];
+            const double x = bodies.x[body];
+            const double y = bodies.y[body];
+            node.mass += bodies.mass[body];
+            node.com_x += bodies.mass[body] * x;
+            node.com_y += bodies.mass[body] * y;
+            node.min_x = std::min(node.min_x, x);
+            node.min_y = std::min(node.min_y, y);
+            node.max_x = std::max(node.max_x, x);
+            node.max_y = std::max(node.max_y, y);
+        }
+        finish_center_of_mass(node);
+    }
+
+    void refit_internal(Node &node) const
+    {
+        node.mass = 0.0;
+        node.com_x = 0.0;
+        node.com_y = 0.0;
+        node.min_x = node.min_y = std::numeric_limits<double>::max();
+        node.max_x = node.max_y = std::numeric_limits<double>::lowest();
+        for (const std::int32_t child_index : node.children)
+        {
+            if (child_index < 0)
+            {
+                continue;
+            }
+            const Node &child = nodes_[child_index];
+            node.mass += child.mass;
+            node.com_x += child.mass * child.com_x;
+            node.com_y += child.mass * child.com_y;
+            node.min_x = std::min(node.min_x, child.min_x);
+            node.min_y = std::min(node.min_y, child.min_y);
+            node.max_x = std::max(node.max_x, child.max_x);
+            node.max_y = std::max(node.max_y, child.max_y);
+        }
+        finish_center_of_mass(node);
+    }
+
+    static void finish_center_of_mass(Node &node)
+    {
+        if (node.mass > 0.0)
+        {
+            node.com_x /= node.mass;
+            node.com_y /= node.mass;
+        }
+        else
+        {
+            node.com_x = (node.min_x + node.max_x) * 0.5;
+            node.com_y = (node.min_y + node.max_y) * 0.5;
+        }
+    }
+
+    void accumulate(const Bodies &bodies, const Params &params, double x, double y,
+        double &acc_x, double &acc_y) const
+    {
+        const double eps2 = params.softening * params.softening;
+        const double theta2 = theta_ * theta_;
+
+        std::array<std::int32_t, 4 * (MAX_LEVEL + 1)> stack;
+        std::size_t stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0)
+        {
+            const Node &node = nodes_[stack[--stack_size]];
+
+            if (node.isLeaf())
+            {
+                for (std::uint32_t k = node.begin; k < node.end; ++k)
+                {
+                    const std::uint32_t other = order_[k];
+                    const double dx = bodies.x[other] - x;
+                    const double dy = bodies.y[other] - y;
+                    // skips the target itself (and exact duplicates, which exert no force)
+                    if (dx != 0.0 || dy != 0.0)
+                    {
+                        add_attraction(dx, dy, bodies.mass[other], eps2, acc_x, acc_y);
+                    }
+                }
+                continue;
+            }
+
+            const double dx = node.com_x - x;
+            const double dy = node.com_y - y;
+            const double size = std::max(node.max_x - node.min_x, node.max_y - node.min_y);
+            const bool inside = x >= node.min_x && x <= node.max_x && y >= node.min_y
+                && y <= node.max_y;
+            if (!inside && size * size < theta2 * (dx * dx + dy * dy))
+            {
+                add_attraction(dx, dy, node.mass, eps2, acc_x, acc_y);
+                continue;
+            }
+
+            for (const std::int32_t child : node.children)
+            {
+                if (child >= 0)
+                {
+                    stack[stack_size++] = child;
+                }
+            }
+        }
+    }
+
+    static inline void add_attraction(double dx, double dy, double mass, double eps2,
+        double &acc_x, double &acc_y)
+    {
+        const double dist2 = dx * dx + dy * dy + eps2;
+        const double inv_dist = 1.0 / std::sqrt(dist2);
+        const double factor = mass * inv_dist * inv_dist * inv_dist;
+        acc_x += dx * factor;
+        acc_y += dy * factor;
+    }
+
+private:
+    double theta_{0.5};
+    std::vector<Node> nodes_;
+    // indices of leaf nodes, refitted in parallel
+    std::vector<std::uint32_t> leaves_;
+    // body indices in Morton order; every node covers a contiguous range of it
+    std::vector<std::uint32_t> order_;
+    std::vector<std::uint64_t> keys_;
+};
+
+} // namespace Gravity
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "Gravity.h"
+#include "Integrators.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Gravity
+{
+
+enum class TimestepCriterion
+{
+    // dt = eta * sqrt(length_scale / |a|)
+    Acceleration,
+    // dt = eta * |a| / |da/dt|, with the jerk taken from the last two force evaluations of the
+    // body
+    Jerk,
+};
+
+inline const char *toString(TimestepCriterion criterion)
+{
+    switch (criterion)
+    {
+    case TimestepCriterion::Acceleration: return "acceleration";
+    case TimestepCriterion::Jerk: return "jerk";
+    }
+    return "";
+}
+
+// Individual power-of-two timesteps (block timesteps) for kick-drift-kick leapfrog.
+// A body on level l steps dt / 2^l, l in [0, max level]. Every substep drifts all bodies, but
+// only the bodies whose step ends there get new forces and kicks, so a tight pair no longer
+// forces the whole system down to its step size. advance() ends with all bodies synchronised.
+class BlockTimestepper
+{
+public:
+    static constexpr std::uint32_t DEFAULT_MAX_LEVEL = 6;
+
+    struct Stats
+    {
+        // substeps (distinct force times) of the last advance()
+        std::size_t substeps{0};
+        // per-body force evaluations of the last advance()
+        std::size_t body_updates{0};
+        // force evaluations a shared step as small as the finest level in use would have cost
+        std::size_t shared_step_updates{0};
+    };
+
+    void setMaxLevel(std::uint32_t level)
+    {
+        assert(level < 31);
+        max_level_ = level;
+    }
+    [[nodiscard]] std::uint32_t getMaxLevel() const { return max_level_; }
+
+    void setCriterion(TimestepCriterion criterion) { criterion_ = criterion; }
+    [[nodiscard]] TimestepCriterion getCriterion() const { return criterion_; }
+
+    // eta of the timestep criterion; smaller is more accurate
+    void setAccuracy(double eta)
+    {
+        assert(eta > 0.0);
+        eta_ = eta;
+    }
+    [[nodiscard]] double getAccuracy() const { return eta_; }
+
+    // length scale of the acceleration criterion, typically the softening length or body size
+    void setLengthScale(double length)
+    {
+        assert(length > 0.0);
+        length_scale_ = length;
+    }
+    [[nodiscard]] double getLengthScale() const { return length_scale_; }
+
+    [[nodiscard]] std::uint32_t getLevel(std::size_t body) const { return levels_[body]; }
+    [[nodiscard]] const Stats &getStats() const { return stats_; }
+
+    // Advances positions (bodies.x/y) and velocities by dt.
+    // compute(active, out) must fill out with the accelerations of the bodies listed in active
+    // (ascending indices) at the current positions of all bodies. acc and acc_valid have the
+    // same meaning as for integrate(); the accelerations are always valid afterwards.
+    template<class ForceFunc>
+    void advance(Bodies &bodies, Velocities &vel, Accelerations &acc, bool &acc_valid,
+        double dt, ForceFunc &&compute)
+    {
+        const std::size_t count = bodies.size();
+        const std::uint32_t ticks = 1u << max_level_;
+        const double tick_dt = dt / ticks;
+        stats_ = Stats{};
+        if (count == 0)
+        {
+            return;
+        }
+
+        if (!acc_valid || levels_.size() != count)
+        {
+            active_.resize(count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                active_[i] = static_cast<std::uint32_t>(i);
+            }
+            compute(active_, acc);
+            acc_valid = true;
+
+            // the jerk is unknown until the second evaluation, so those bodies start finest
+            levels_.resize(count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                levels_[i] = criterion_ == TimestepCriterion::Jerk
+                    ? max_level_
+                    : level_for(dt, acceleration_step(acc.x[i], acc.y[i]));
+            }
+        }
+
+        // every body opens a step at the start of the block
+        step_end_.resize(count);
+        std::uint32_t finest = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            levels_[i] = std::min(levels_[i], max_level_);
+            step_end_[i] = stride(levels_[i]);
+            kick(vel, acc, i, 0.5 * step_end_[i] * tick_dt);
+            finest = std::max(finest, levels_[i]);
+        }
+
+        std::uint32_t tick = 0;
+        while (tick < ticks)
+        {
+            const std::uint32_t next = *std::min_element(step_end_.begin(), step_end_.end());
+            const double h = (next - tick) * tick_dt;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                bodies.x[i] += vel.x[i] * h;
+                bodies.y[i] += vel.y[i] * h;
+            }
+            tick = next;
+
+            active_.clear();
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (step_end_[i] == tick)
+                {
+                    active_.push_back(static_cast<std::uint32_t>(i));
+                }
+            }
+            compute(active_, active_acc_);
+            assert(active_acc_.size() == active_.size());
+
+            for (std::size_t k = 0; k < active_.size(); ++k)
+            {
+                const std::uint32_t i = active_[k];
+                const double step = stride(levels_[i]) * tick_dt;
+                const double acc_x = active_acc_.x[k];
+                const double acc_y = active_acc_.y[k];
+                const double desired = criterion_ == TimestepCriterion::Jerk
+                    ? jerk_step(acc_x, acc_y, acc.x[i], acc.y[i], step)
+                    : acceleration_step(acc_x, acc_y);
+                acc.x[i] = acc_x;
+                acc.y[i] = acc_y;
+
+                // closing half-kick of the finished step
+                kick(vel, acc, i, 0.5 * step);
+                if (tick == ticks)
+                {
+                    continue;
+                }
+
+                levels_[i] = relevel(levels_[i], level_for(dt, desired), tick);
+                step_end_[i] = tick + stride(levels_[i]);
+                kick(vel, acc, i, 0.5 * stride(levels_[i]) * tick_dt);
+                finest = std::max(finest, levels_[i]);
+            }
+
+            stats_.substeps++;
+            stats_.body_updates += active_.size();
+        }
+        stats_.shared_step_updates = count << finest;
+    }
+
+private:
+    // length of a step on the given level, in ticks of the finest level
+    [[nodiscard]] std::uint32_t stride(std::uint32_t level) const
+    {
+        return 1u << (max_level_ - level);
+    }
+
+    [[nodiscard]] double acceleration_step(double acc_x, double acc_y) const
+    {
+        const double magnitude = std::sqrt(acc_x * acc_x + acc_y * acc_y);
+        return magnitude > 0.0 ? eta_ * std::sqrt(length_scale_ / magnitude)
+                               : std::numeric_limits<double>::infinity();
+    }
+
+    [[nodiscard]] double jerk_step(double acc_x, double acc_y, double old_acc_x,
+        double old_acc_y, double elapsed) const
+    {
+        const double jerk_x = (acc_x - old_acc_x) / elapsed;
+        const double jerk_y = (acc_y - old_acc_y) / elapsed;
+        const double jerk = std::sqrt(jerk_x * jerk_x + jerk_y * jerk_y);
+        const double magnitude = std::sqrt(acc_x * acc_x + acc_y * acc_y);
+        return jerk > 0.0 ? eta_ * magnitude / jerk : std::numeric_limits<double>::infinity();
+    }
+
+    // coarsest level whose step does not exceed the desired one
+    [[nodiscard]] std::uint32_t level_for(double dt, double desired) const
+    {
+        std::uint32_t level = 0;
+        while (level < max_level_ && dt / static_cast<double>(1u << level) > desired)
+        {
+            level++;
+        }
+        return level;
+    }
+
+    // Refining is always allowed. Coarsening goes one level at a time and only where the
+    // coarser step starts, so that every step stays aligned to its own grid.
+    [[nodiscard]] std::uint32_t relevel(std::uint32_t current, std::uint32_t wanted,
+        std::uint32_t tick) const
+    {
+        if (wanted >= current)
+        {
+            return wanted;
+        }
+        const std::uint32_t coarser = current - 1;
+        return tick % stride(coarser) == 0 ? coarser : current;
+    }
+
+    static void kick(Velocities &vel, const Accelerations &acc, std::size_t i, double h)
+    {
+        vel.x[i] += acc.x[i] * h;
+        vel.y[i] += acc.y[i] * h;
+    }
+
+private:
+    std::uint32_t max_level_{DEFAULT_MAX_LEVEL};
+    TimestepCriterion criterion_{TimestepCriterion::Acceleration};
+    double eta_{0.05};
+    double length_scale_{1.0};
+
+    std::vector<std::uint32_t> levels_;
+    // tick at which the current step of each body ends
+    std::vector<std::uint32_t> step_end_;
+    std::vector<std::uint32_t> active_;
+    Accelerations active_acc_;
+    Stats stats_;
+};
+
+} // namespace Gravity
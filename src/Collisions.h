@@ -0,0 +1,215 @@
+#pragma once
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Collision
+{
+
+// Two overlapping circles, a < b.
+struct Pair
+{
+    std::uint32_t a;
+    std::uint32_t b;
+
+    bool operator<(const Pair &other) const
+    {
+        return a != other.a ? a < other.a : b < other.b;
+    }
+};
+
+// Uniform spatial hash broadphase for circles.
+// Every circle is entered into each grid cell its bounding box touches, and the cells are
+// hashed into a counting-sorted bucket table, so memory is proportional to the number of
+// entries rather than to the extent of the scene. A candidate pair is only tested in the cell
+// holding the lowest corner of the overlap of the two boxes, so each pair is reported once.
+class SpatialHash
+{
+public:
+    // Edge length of a cell; 0 picks twice the mean radius.
+    void setCellSize(double size)
+    {
+        assert(size >= 0.0);
+        cell_size_ = size;
+    }
+    [[nodiscard]] double getCellSize() const { return cell_size_; }
+
+    // Fills pairs with every pair of circles closer than the sum of their radii, sorted.
+    void findOverlaps(const double *x, const double *y, const double *radius, std::size_t count,
+        std::vector<Pair> &pairs)
+    {
+        pairs.clear();
+        if (count < 2)
+        {
+            return;
+        }
+        build(x, y, radius, count);
+
+        const std::size_t workers = Parallel::getThreadCount();
+        worker_pairs_.resize(workers);
+        for (std::vector<Pair> &found : worker_pairs_)
+        {
+            found.clear();
+        }
+        const std::size_t grain = std::max<std::size_t>(256, count / (workers * 8));
+        const std::size_t tasks = (count + grain - 1) / grain;
+        Parallel::run(tasks, [&](std::size_t task, std::size_t worker) {
+            const std::size_t end = std::min(count, (task + 1) * grain);
+            for (std::size_t i = task * grain; i < end; ++i)
+            {
+                query(x, y, radius, static_cast<std::uint32_t>(i), worker_pairs_[worker]);
+            }
+        });
+
+        for (const std::vector<Pair> &found : worker_pairs_)
+        {
+            pairs.insert(pairs.end(), found.begin(), found.end());
+        }
+        std::sort(pairs.begin(), pairs.end());
+    }
+
+private:
+    struct CellRange
+    {
+        std::int32_t min_x;
+        std::int32_t min_y;
+        std::int32_t max_x;
+        std::int32_t max_y;
+    };
+
+    struct Entry
+    {
+        std::uint32_t body;
+        std::int32_t cell_x;
+        std::int32_t cell_y;
+    };
+
+    // cells a single circle may cover along each axis, bounding the entries of huge bodies
+    static constexpr double MAX_CELLS_PER_AXIS = 16.0;
+
+    [[nodiscard]] std::uint32_t bucket_of(std::int32_t cell_x, std::int32_t cell_y) const
+    {
+        const auto hash = static_cast<std::uint32_t>(cell_x) * 73856093u
+            ^ static_cast<std::uint32_t>(cell_y) * 19349663u;
+        return hash & bucket_mask_;
+    }
+
+    void build(const double *x, const double *y, const double *radius, std::size_t count)
+    {
+        double max_radius = 0.0;
+        double sum_radius = 0.0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            max_radius = std::max(max_radius, radius[i]);
+            sum_radius += radius[i];
+        }
+        double cell = cell_size_ > 0.0 ? cell_size_ : 2.0 * sum_radius / count;
+        cell = std::max({cell, 2.0 * max_radius / MAX_CELLS_PER_AXIS, 1e-9});
+        const double inv_cell = 1.0 / cell;
+
+        ranges_.resize(count);
+        std::size_t entry_count = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            CellRange &range = ranges_[i];
+            range.min_x = static_cast<std::int32_t>(std::floor((x[i] - radius[i]) * inv_cell));
+            range.min_y = static_cast<std::int32_t>(std::floor((y[i] - radius[i]) * inv_cell));
+            range.max_x = static_cast<std::int32_t>(std::floor((x[i] + radius[i]) * inv_cell));
+            range.max_y = static_cast<std::int32_t>(std::floor((y[i] + radius[i]) * inv_cell));
+            const std::size_t cells = static_cast<std::size_t>(range.max_x - range.min_x + 1)
+                * static_cast<std::size_t>(range.max_y - range.min_y + 1);
+            entry_count += cells;
+        }
+
+        std::size_t buckets = 1;
+        while (buckets < entry_count)
+        {
+            buckets *= 2;
+        }
+        bucket_mask_ = static_cast<std::uint32_t>(buckets - 1);
+
+        // counting sort of the entries by bucket
+        bucket_starts_.assign(buckets + 1, 0);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            for_each_cell(ranges_[i], [&](std::int32_t cell_x, std::int32_t cell_y) {
+                bucket_starts_[bucket_of(cell_x, cell_y) + 1]++;
+            });
+        }
+        for (std::size_t b = 0; b < buckets; ++b)
+        {
+            bucket_starts_[b + 1] += bucket_starts_[b];
+        }
+        fill_cursor_.assign(bucket_starts_.begin(), bucket_starts_.end() - 1);
+        entries_.resize(entry_count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            for_each_cell(ranges_[i], [&](std::int32_t cell_x, std::int32_t cell_y) {
+                const std::uint32_t bucket = bucket_of(cell_x, cell_y);
+                entries_[fill_cursor_[bucket]++] =
+                    Entry{static_cast<std::uint32_t>(i), cell_x, cell_y};
+            });
+        }
+    }
+
+    template<class F>
+    static void for_each_cell(const CellRange &range, F &&func)
+    {
+        for (std::int32_t cell_y = range.min_y; cell_y <= range.max_y; ++cell_y)
+        {
+            for (std::int32_t cell_x = range.min_x; cell_x <= range.max_x; ++cell_x)
+            {
+                func(cell_x, cell_y);
+            }
+        }
+    }
+
+    void query(const double *x, const double *y, const double *radius, std::uint32_t body,
+        std::vector<Pair> &pairs) const
+    {
+        const CellRange &range = ranges_[body];
+        for_each_cell(range, [&](std::int32_t cell_x, std::int32_t cell_y) {
+            const std::uint32_t bucket = bucket_of(cell_x, cell_y);
+            for (std::size_t e = bucket_starts_[bucket]; e < bucket_starts_[bucket + 1]; ++e)
+            {
+                const Entry &entry = entries_[e];
+                if (entry.body <= body || entry.cell_x != cell_x || entry.cell_y != cell_y)
+                {
+                    continue;
+                }
+                // report the pair only from the first cell both boxes share
+                const CellRange &other = ranges_[entry.body];
+                if (std::max(range.min_x, other.min_x) != cell_x
+                    || std::max(range.min_y, other.min_y) != cell_y)
+                {
+                    continue;
+                }
+                const double dx = x[entry.body] - x[body];
+                const double dy = y[entry.body] - y[body];
+                const double reach = radius[entry.body] + radius[body];
+                if (dx * dx + dy * dy < reach * reach)
+                {
+                    pairs.push_back(Pair{body, entry.body});
+                }
+            }
+        });
+    }
+
+private:
+    double cell_size_{0.0};
+
+    std::vector<CellRange> ranges_;
+    std::uint32_t bucket_mask_{0};
+    std::vector<std::size_t> bucket_starts_;
+    std::vector<std::size_t> fill_cursor_;
+    std::vector<Entry> entries_;
+    std::vector<std::vector<Pair>> worker_pairs_;
+};
+
+} // namespace Collision
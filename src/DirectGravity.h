@@ -0,0 +1,796 @@
+#pragma once
+
+#include "Gravity.h"
+#include "Morton.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define GRAVITY_X86_SIMD 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+        #define GRAVITY_TARGET_AVX2
+        #define GRAVITY_TARGET_AVX512
+    #else
+        #define GRAVITY_TARGET_AVX2   __attribute__((target("avx2,fma")))
+        #define GRAVITY_TARGET_AVX512 __attribute__((target("avx512f")))
+    #endif
+#else
+    #define GRAVITY_X86_SIMD 0
+#endif
+
+namespace Gravity
+{
+
+enum class SimdLevel
+{
+    Scalar,
+    Avx2,
+    Avx512,
+};
+
+inline const char *toString(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Scalar: return "scalar";
+    case SimdLevel::Avx2: return "avx2";
+    case SimdLevel::Avx512: return "avx512";
+    }
+    return "";
+}
+
+// Widest instruction set supported by both the CPU and the OS.
+inline SimdLevel detectSimdLevel()
+{
+#if GRAVITY_X86_SIMD
+    #if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    const bool has_fma = (info[2] & (1 << 12)) != 0;
+    const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    if (!has_osxsave)
+    {
+        return SimdLevel::Scalar;
+    }
+    const unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    const bool has_avx2 = (info[1] & (1 << 5)) != 0 && has_fma && (xcr0 & 0x6) == 0x6;
+    const bool has_avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    #else
+    __builtin_cpu_init();
+    const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    const bool has_avx512 = __builtin_cpu_supports("avx512f");
+    #endif
+    if (has_avx512)
+    {
+        return SimdLevel::Avx512;
+    }
+    if (has_avx2)
+    {
+        return SimdLevel::Avx2;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+enum class Precision
+{
+    // pair forces in double
+    Double,
+    // positions as float offsets from the center of each row tile, pair forces in float,
+    // Kahan-compensated float sums per tile added into double accumulators
+    Mixed,
+};
+
+inline const char *toString(Precision precision)
+{
+    switch (precision)
+    {
+    case Precision::Double: return "double";
+    case Precision::Mixed: return "mixed";
+    }
+    return "";
+}
+
+namespace Kernels
+{
+
+// Every kernel adds the attraction of sources [j_begin, j_end) to the targets
+// [i_begin, i_end). Accelerations are accumulated without the gravity constant. Pairs at zero
+// distance contribute nothing, which also removes the self-interaction when a body is both
+// target and source. The symmetric variants use the sources as targets, only visit j > i and
+// apply the opposite force to body j as well.
+
+inline void rowsScalar(const double *tx, const double *ty, std::size_t i_begin,
+    std::size_t i_end, const double *x, const double *y, const double *m, std::size_t j_begin,
+    std::size_t j_end, double eps2, double *acc_x, double *acc_y)
+{
+    for (std::size_t i = i_begin; i < i_end; ++i)
+    {
+        double sum_x = 0.0;
+        double sum_y = 0.0;
+        for (std::size_t j = j_begin; j < j_end; ++j)
+        {
+            const double dx = x[j] - tx[i];
+            const double dy = y[j] - ty[i];
+            const double dist2 = dx * dx + dy * dy + eps2;
+            const double inv_dist = dist2 > 0.0 ? 1.0 / std::sqrt(dist2) : 0.0;
+            const double factor = m[j] * inv_dist * inv_dist * inv_dist;
+            sum_x += dx * factor;
+            sum_y += dy * factor;
+        }
+        acc_x[i] += sum_x;
+        acc_y[i] += sum_y;
+    }
+}
+
+inline void rowsSymmetricScalar(const double *x, const double *y, const double *m,
+    std::size_t i_begin, std::size_t i_end, std::size_t j_begin, std::size_t j_end, double eps2,
+    double *acc_x, double *acc_y)
+{
+    for (std::size_t i = i_begin; i < i_end; ++i)
+    {
+        double sum_x = 0.0;
+        double sum_y = 0.0;
+        for (std::size_t j = std::max(j_begin, i + 1); j < j_end; ++j)
+        {
+            const double dx = x[j] - x[i];
+            const double dy = y[j] - y[i];
+            const double dist2 = dx * dx + dy * dy + eps2;
+            const double inv_dist = dist2 > 0.0 ? 1.0 / std::sqrt(dist2) : 0.0;
+            const double inv_dist3 = inv_dist * inv_dist * inv_dist;
+            sum_x += dx * m[j] * inv_dist3;
+            sum_y += dy * m[j] * inv_dist3;
+            acc_x[j] -= dx * m[i] * inv_dist3;
+            acc_y[j] -= dy * m[i] * inv_dist3;
+        }
+        acc_x[i] += sum_x;
+        acc_y[i] += sum_y;
+    }
+}
+
+// Mixed-precision variant of rowsScalar. Each row sums its float terms with Kahan compensation
+// and adds the compensated total to the double accumulators.
+inline void rowsMixedScalar(const float *tx, const float *ty, std::size_t i_begin,
+    std::size_t i_end, const float *x, const float *y, const float *m, std::size_t j_begin,
+    std::size_t j_end, float eps2, double *acc_x, double *acc_y)
+{
+    for (std::size_t i = i_begin; i < i_end; ++i)
+    {
+        float sum_x = 0.0f;
+        float sum_y = 0.0f;
+        float comp_x = 0.0f;
+        float comp_y = 0.0f;
+        for (std::size_t j = j_begin; j < j_end; ++j)
+        {
+            const float dx = x[j] - tx[i];
+            const float dy = y[j] - ty[i];
+            const float dist2 = dx * dx + dy * dy + eps2;
+            const float inv_dist = dist2 > 0.0f ? 1.0f / std::sqrt(dist2) : 0.0f;
+            const float factor = m[j] * inv_dist * inv_dist * inv_dist;
+
+            const float term_x = dx * factor - comp_x;
+            const float total_x = sum_x + term_x;
+            comp_x = (total_x - sum_x) - term_x;
+            sum_x = total_x;
+            const float term_y = dy * factor - comp_y;
+            const float total_y = sum_y + term_y;
+            comp_y = (total_y - sum_y) - term_y;
+            sum_y = total_y;
+        }
+        acc_x[i] += static_cast<double>(sum_x) - comp_x;
+        acc_y[i] += static_cast<double>(sum_y) - comp_y;
+    }
+}
+
+#if GRAVITY_X86_SIMD
+
+GRAVITY_TARGET_AVX2 inline double horizontalSum(__m256d value)
+{
+    const __m128d low = _mm256_castpd256_pd128(value);
+    const __m128d high = _mm256_extractf128_pd(value, 1);
+    const __m128d sum = _mm_add_pd(low, high);
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+// Returns |d|^-3 per lane, or 0 where the squared distance is 0.
+GRAVITY_TARGET_AVX2 inline __m256d inverseCube(__m256d dx, __m256d dy, __m256d eps2)
+{
+    const __m256d dist2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, eps2));
+    const __m256d inv_dist = _mm256_div_pd(_mm256_set1_pd(1.0), _mm256_sqrt_pd(dist2));
+    const __m256d inv_dist3 = _mm256_mul_pd(inv_dist, _mm256_mul_pd(inv_dist, inv_dist));
+    const __m256d nonzero = _mm256_cmp_pd(dist2, _mm256_setzero_pd(), _CMP_GT_OQ);
+    return _mm256_and_pd(inv_dist3, nonzero);
+}
+
+GRAVITY_TARGET_AVX2 inline void rowsAvx2(const double *tx, const double *ty, std::size_t i_begin,
+    std::size_t i_end, const double *x, const double *y, const double *m, std::size_t j_begin,
+    std::size_t j_end, double eps2, double *acc_x, double *acc_y)
+{
+    const __m256d eps2_v = _mm256_set1_pd(eps2);
+    const std::size_t j_vec_end = j_begin + (j_end - j_begin) / 4 * 4;
+    for (std::size_t i = i_begin; i < i_end; ++i)
+    {
+        const __m256d xi = _mm256_set1_pd(tx[i]);
+        const __m256d yi = _mm256_set1_pd(ty[i]);
+        __m256d sum_x = _mm256_setzero_pd();
+        __m256d sum_y = _mm256_setzero_pd();
+        for (std::size_t j = j_begin; j < j_vec_end; j += 4)
+        {
+            const __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+            const __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+            const __m256d inv_dist3 = inverseCube(dx, dy, eps2_v);
+            const __m256d factor = _mm256_mul_pd(_mm256_loadu_pd(m + j), inv_dist3);
+            sum_x = _mm256_fmadd_pd(dx, factor, sum_x);
+            sum_y = _mm256_fmadd_pd(dy, factor, sum_y);
+        }
+        acc_x[i] += horizontalSum(sum_x);
+        acc_y[i] += horizontalSum(sum_y);
+    }
+    rowsScalar(tx, ty, i_begin, i_end, x, y, m, j_vec_end, j_end, eps2, acc_x, acc_y);
+}
+
+GRAVITY_TARGET_AVX2 inline void rowsSymmetricAvx2(const double *x, const double *y,
+    const double *m, std::size_t i_begin, std::size_t i_end, std::size_t j_begin,
+    std::size_t j_end, double eps2, double *acc_x, double *acc_y)
+{
+    const __m256d eps2_v = _mm256_set1_pd(eps2);
+    for (std::size_t i = i_begin; i < i_end; ++i)
+    {
+        const std::size_t j_first = std::max(j_begin, i + 1);
+        const std::size_t j_vec_end = j_first + (j_end - std::min(j_end, j_first)) / 4 * 4;
+        const __m256d xi = _mm256_set1_pd(x[i]);
+        const __m256d yi = _mm256_set1_pd(y[i]);
+        const __m256d mi = _mm256_set1_pd(m[i]);
+        __m256d sum_x = _mm256_setzero_pd();
+        __m256d sum_y = _mm256_setzero_pd();
+        for (std::size_t j = j_first; j < j_vec_end; j += 4)
+        {
+            const __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+            const __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+            const __m256d inv_dist3 = inverseCube(dx, dy, eps2_v);
+            const __m256d factor_i = _mm256_mul_pd(_mm256_loadu_pd(m + j), inv_dist3);
+            const __m256d factor_j = _mm256_mul_pd(mi, inv_dist3);
+            sum_x = _mm256_fmadd_pd(dx, factor_i, sum_x);
+            sum_y = _mm256_fmadd_pd(dy, factor_i, sum_y);
+            const __m256d acc_xj = _mm256_loadu_pd(acc_x + j);
+            _mm256_storeu_pd(acc_x + j, _mm256_fnmadd_pd(dx, factor_j, acc_xj));
+            const __m256d acc_yj = _mm256_loadu_pd(acc_y + j);
+            _mm256_storeu_pd(acc_y + j, _mm256_fnmadd_pd(dy, factor_j, acc_yj));
+        }
+        acc_x[i] += horizontalSum(sum_x);
+        acc_y[i] += horizontalSum(sum_y);
+        if (j_vec_end < j_end)
+        {
+            rowsSymmetricScalar(x, y, m, i, i + 1, j_vec_end, j_end, eps2, acc_x, acc_y);
+        }
+    }
+}
+
+// Sum over the lanes of a Kahan sum and its compensation, in double.
+GRAVITY_TARGET_AVX2 inline double compensatedSum(__m256 sum, __m256 comp)
+{
+    const __m256d low = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(sum)),
+        _mm256_cvtps_pd(_mm256_castps256_ps128(comp)));
+    const __m256d high = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(sum, 1)),
+        _mm256_cvtps_pd(_mm256_extractf128_ps(comp, 1)));
+    return horizontalSum(_mm256_add_pd(low, high));
+}
+
+GRAVITY_TARGET_AVX2 inline void kahanAdd(__m256 term, __m256 &sum, __m256 &comp)
+{
+    const __m256 corrected = _mm256_sub_ps(term, comp);
+    const __m256 total = _mm256_add_ps(sum, corrected);
+    comp = _mm256_sub_ps(_mm256_sub_ps(total, sum), corrected);
+    sum = total;
+}
+
+GRAVITY_TARGET_AVX2 inline void rowsMixedAvx2(const float *tx, const float *ty,
+    std::size_t i_begin, std::size_t i_end, const float *x, const float *y, const float *m,
+    std::size_t j_begin, std::size_t j_end, float eps2, double *acc_x, double *acc_y)
+{
+    const __m256 eps2_v = _mm256_set1_ps(eps2);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const std::size_t j_vec_end = j_begin + (j_end - j_begin) / 8 * 8;
+    for (std::size_t i = i_begin; i < i_end; ++i)
+    {
+        const __m256 xi = _mm256_set1_ps(tx[i]);
+        const __m256 yi = _mm256_set1_ps(ty[i]);
+        __m256 sum_x = _mm256_setzero_ps();
+        __m256 sum_y = _mm256_setzero_ps();
+        __m256 comp_x = _mm256_setzero_ps();
+        __m256 comp_y = _mm256_setzero_ps();
+        for (std::size_t j = j_begin; j < j_vec_end; j += 8)
+        {
+            const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + j), xi);
+            const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + j), yi);
+            const __m256 dist2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, eps2_v));
+            const __m256 inv_dist = _mm256_div_ps(one, _mm256_sqrt_ps(dist2));
+            const __m256 nonzero = _mm256_cmp_ps(dist2, _mm256_setzero_ps(), _CMP_GT_OQ);
+            const __m256 inv_dist3 =
+                _mm256_and_ps(_mm256_mul_ps(inv_dist, _mm256_mul_ps(inv_dist, inv_dist)), nonzero);
+            const __m256 factor = _mm256_mul_ps(_mm256_loadu_ps(m + j), inv_dist3);
+            kahanAdd(_mm256_mul_ps(dx, factor), sum_x, comp_x);
+            kahanAdd(_mm256_mul_ps(dy, factor), sum_y, comp_y);
+        }
+        acc_x[i] += compensatedSum(sum_x, comp_x);
+        acc_y[i] += compensatedSum(sum_y, comp_y);
+    }
+    rowsMixedScalar(tx, ty, i_begin, i_end, x, y, m, j_vec_end, j_end, eps2, acc_x, acc_y);
+}
+
+// Returns |d|^-3 per lane, or 0 where the squared distance is 0.
+GRAVITY_TARGET_AVX512 inline __m512d inverseCube(__m512d dx, __m512d dy, __m512d eps2)
+{
+    const __m512d dist2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, eps2));
+    const __mmask8 nonzero = _mm512_cmp_pd_mask(dist2, _mm512_setzero_pd(), _CMP_GT_OQ);
+    const __m512d inv_dist = _mm512_div_pd(_mm512_set1_pd(1.0), _mm512_sqrt_pd(dist2));
+    const __m512d inv_dist3 = _mm512_mul_pd(inv_dist, _mm512_mul_pd(inv_dist, inv_dist));
+    return _mm512_maskz_mov_pd(nonzero, inv_dist3);
+}
+
+GRAVITY_TARGET_AVX512 inline void rowsAvx512(const double *tx, const double *ty,
+    std::size_t i_begin, std::size_t i_end, const double *x, const double *y, const double *m,
+    std::size_t j_begin, std::size_t j_end, double eps2, double *acc_x, double *acc_y)
+{
+    const __m512d eps2_v = _mm512_set1_pd(eps2);
+    const std::size_t j_vec_end = j_begin + (j_end - j_begin) / 8 * 8;
+    for (std::size_t i = i_begin; i < i_end; ++i)
+    {
+        const __m512d xi = _mm512_set1_pd(tx[i]);
+        const __m512d yi = _mm512_set1_pd(ty[i]);
+        __m512d sum_x = _mm512_setzero_pd();
+        __m512d sum_y = _mm512_setzero_pd();
+        for (std::size_t j = j_begin; j < j_vec_end; j += 8)
+        {
+            const __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x + j), xi);
+            const __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y + j), yi);
+            const __m512d inv_dist3 = inverseCube(dx, dy, eps2_v);
+            const __m512d factor = _mm512_mul_pd(_mm512_loadu_pd(m + j), inv_dist3);
+            sum_x = _mm512_fmadd_pd(dx, factor, sum_x);
+            sum_y = _mm512_fmadd_pd(dy, factor, sum_y);
+        }
+        acc_x[i] += _mm512_reduce_add_pd(sum_x);
+        acc_y[i] += _mm512_reduce_add_pd(sum_y);
+    }
+    rowsScalar(tx, ty, i_begin, i_end, x, y, m, j_vec_end, j_end, eps2, acc_x, acc_y);
+}
+
+GRAVITY_TARGET_AVX512 inline void rowsSymmetricAvx512(const double *x, const double *y,
+    const double *m, std::size_t i_begin, std::size_t i_end, std::size_t j_begin,
+    std::size_t j_end, double eps2, double *acc_x, double *acc_y)
+{
+    const __m512d eps2_v = _mm512_set1_pd(eps2);
+    for (std::size_t i = i_begin; i < i_end; ++i)
+    {
+        const std::size_t j_first = std::max(j_begin, i + 1);
+        const std::size_t j_vec_end = j_first + (j_end - std::min(j_end, j_first)) / 8 * 8;
+        const __m512d xi = _mm512_set1_pd(x[i]);
+        const __m512d yi = _mm512_set1_pd(y[i]);
+        const __m512d mi = _mm512_set1_pd(m[i]);
+        __m512d sum_x = _mm512_setzero_pd();
+        __m512d sum_y = _mm512_setzero_pd();
+        for (std::size_t j = j_first; j < j_vec_end; j += 8)
+        {
+            const __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x + j), xi);
+            const __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y + j), yi);
+            const __m512d inv_dist3 = inverseCube(dx, dy, eps2_v);
+            const __m512d factor_i = _mm512_mul_pd(_mm512_loadu_pd(m + j), inv_dist3);
+            const __m512d factor_j = _mm512_mul_pd(mi, inv_dist3);
+            sum_x = _mm512_fmadd_pd(dx, factor_i, sum_x);
+            sum_y = _mm512_fmadd_pd(dy, factor_i, sum_y);
+            const __m512d acc_xj = _mm512_loadu_pd(acc_x + j);
+            _mm512_storeu_pd(acc_x + j, _mm512_fnmadd_pd(dx, factor_j, acc_xj));
+            const __m512d acc_yj = _mm512_loadu_pd(acc_y + j);
+            _mm512_storeu_pd(acc_y + j, _mm512_fnmadd_pd(dy, factor_j, acc_yj));
+        }
+        acc_x[i] += _mm512_reduce_add_pd(sum_x);
+        acc_y[i] += _mm512_reduce_add_pd(sum_y);
+        if (j_vec_end < j_end)
+        {
+            rowsSymmetricScalar(x, y, m, i, i + 1, j_vec_end, j_end, eps2, acc_x, acc_y);
+        }
+    }
+}
+
+GRAVITY_TARGET_AVX512 inline double compensatedSum(__m512 sum, __m512 comp)
+{
+    const __m512d low = _mm512_sub_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(sum)),
+        _mm512_cvtps_pd(_mm512_castps512_ps256(comp)));
+    const __m512d high = _mm512_sub_pd(
+        _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(sum), 1))),
+        _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(comp), 1))));
+    return _mm512_reduce_add_pd(_mm512_add_pd(low, high));
+}
+
+GRAVITY_TARGET_AVX512 inline void kahanAdd(__m512 term, __m512 &sum, __m512 &comp)
+{
+    const __m512 corrected = _mm512_sub_ps(term, comp);
+    const __m512 total = _mm512_add_ps(sum, corrected);
+    comp = _mm512_sub_ps(_mm512_sub_ps(total, sum), corrected);
+    sum = total;
+}
+
+GRAVITY_TARGET_AVX512 inline void rowsMixedAvx512(const float *tx, const float *ty,
+    std::size_t i_begin, std::size_t i_end, const float *x, const float *y, const float *m,
+    std::size_t j_begin, std::size_t j_end, float eps2, double *acc_x, double *acc_y)
+{
+    const __m512 eps2_v = _mm512_set1_ps(eps2);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const std::size_t j_vec_end = j_begin + (j_end - j_begin) / 16 * 16;
+    for (std::size_t i = i_begin; i < i_end; ++i)
+    {
+        const __m512 xi = _mm512_set1_ps(tx[i]);
+        const __m512 yi = _mm512_set1_ps(ty[i]);
+        __m512 sum_x = _mm512_setzero_ps();
+        __m512 sum_y = _mm512_setzero_ps();
+        __m512 comp_x = _mm512_setzero_ps();
+        __m512 comp_y = _mm512_setzero_ps();
+        for (std::size_t j = j_begin; j < j_vec_end; j += 16)
+        {
+            const __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(x + j), xi);
+            const __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(y + j), yi);
+            const __m512 dist2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, eps2_v));
+            const __mmask16 nonzero = _mm512_cmp_ps_mask(dist2, _mm512_setzero_ps(), _CMP_GT_OQ);
+            const __m512 inv_dist = _mm512_div_ps(one, _mm512_sqrt_ps(dist2));
+            const __m512 inv_dist3 = _mm512_maskz_mov_ps(nonzero,
+                _mm512_mul_ps(inv_dist, _mm512_mul_ps(inv_dist, inv_dist)));
+            const __m512 factor = _mm512_mul_ps(_mm512_loadu_ps(m + j), inv_dist3);
+            kahanAdd(_mm512_mul_ps(dx, factor), sum_x, comp_x);
+            kahanAdd(_mm512_mul_ps(dy, factor), sum_y, comp_y);
+        }
+        acc_x[i] += compensatedSum(sum_x, comp_x);
+        acc_y[i] += compensatedSum(sum_y, comp_y);
+    }
+    rowsMixedScalar(tx, ty, i_begin, i_end, x, y, m, j_vec_end, j_end, eps2, acc_x, acc_y);
+}
+
+#endif
+
+} // namespace Kernels
+
+// Cache-tiled, multithreaded direct summation. The i and j ranges are cut into tiles small
+// enough for a j tile to stay in cache while every row of the i tile sweeps over it. The
+// kernel matching the best supported instruction set is picked once at construction.
+class DirectSolver
+{
+public:
+    static constexpr std::size_t DEFAULT_TILE_SIZE = 512;
+    static constexpr std::size_t MIN_ROW_TILE = 16;
+    // mixed-precision row tiles never straddle a cell of a 2^level grid over the targets
+    static constexpr std::uint32_t MIXED_SPLIT_LEVEL = 6;
+
+    DirectSolver()
+        : simd_level_(detectSimdLevel())
+    {}
+
+    // Requests a narrower instruction set; wider levels than the CPU supports are ignored.
+    void setSimdLevel(SimdLevel level) { simd_level_ = std::min(level, detectSimdLevel()); }
+    [[nodiscard]] SimdLevel getSimdLevel() const { return simd_level_; }
+
+    // Symmetric mode evaluates each pair once and applies it to both bodies.
+    void setSymmetric(bool symmetric) { symmetric_ = symmetric; }
+    [[nodiscard]] bool isSymmetric() const { return symmetric_; }
+
+    // Mixed precision trades about seven significant digits of the pair forces for twice the
+    // SIMD width; symmetric mode does not apply to it.
+    void setPrecision(Precision precision) { precision_ = precision; }
+    [[nodiscard]] Precision getPrecision() const { return precision_; }
+
+    void setTileSize(std::size_t tile_size) { tile_size_ = std::max<std::size_t>(tile_size, 8); }
+    [[nodiscard]] std::size_t getTileSize() const { return tile_size_; }
+
+    // Accelerations of every body due to all the others.
+    // Rows are split into tiles that the shared thread pool hands out with work stealing.
+    // In symmetric mode every worker accumulates into its own buffer, and the buffers are
+    // summed at the end, so no atomics are needed.
+    void computeAccelerations(const Bodies &bodies, const Params &params, Accelerations &acc)
+    {
+        if (!symmetric_ || precision_ == Precision::Mixed)
+        {
+            computeAccelerationsAt(bodies, bodies.x.data(), bodies.y.data(), bodies.size(), params,
+                acc);
+            return;
+        }
+
+        const std::size_t count = bodies.size();
+        acc.reset(count);
+        if (count == 0)
+        {
+            return;
+        }
+        const double eps2 = params.softening * params.softening;
+        const std::size_t threads = Parallel::getThreadCount();
+        const std::size_t row_tile = get_row_tile(count);
+        const std::size_t row_tiles = (count + row_tile - 1) / row_tile;
+
+        worker_acc_.resize(threads);
+        for (Accelerations &worker_acc : worker_acc_)
+        {
+            worker_acc.reset(count);
+        }
+
+        // the symmetric kernels only look at j > i, so j tiles start at the row tile
+        Parallel::run(row_tiles, [&](std::size_t task, std::size_t worker) {
+            const std::size_t i_begin = task * row_tile;
+            const std::size_t i_end = std::min(count, i_begin + row_tile);
+            for (std::size_t j_begin = i_begin; j_begin < count; j_begin += tile_size_)
+            {
+                const std::size_t j_end = std::min(count, j_begin + tile_size_);
+                run_symmetric_tile(bodies, i_begin, i_end, j_begin, j_end, eps2,
+                    worker_acc_[worker]);
+            }
+        });
+
+        Parallel::forRange(count, [&](std::size_t begin, std::size_t end) {
+            for (const Accelerations &worker_acc : worker_acc_)
+            {
+                for (std::size_t i = begin; i < end; ++i)
+                {
+                    acc.x[i] += worker_acc.x[i];
+                    acc.y[i] += worker_acc.y[i];
+                }
+            }
+        });
+        scale(acc, params.gravity);
+    }
+
+    // Accelerations at target_count arbitrary points due to all sources. A target that
+    // coincides with a source ignores it, so passing the sources' own positions yields the
+    // usual all-pairs result. Symmetric mode does not apply here.
+    void computeAccelerationsAt(const Bodies &sources, const double *target_x,
+        const double *target_y, std::size_t target_count, const Params &params,
+        Accelerations &acc) const
+    {
+        acc.reset(target_count);
+        const std::size_t count = sources.size();
+        if (target_count == 0 || count == 0)
+        {
+            return;
+        }
+        if (precision_ == Precision::Mixed)
+        {
+            compute_mixed(sources, target_x, target_y, target_count, params, acc);
+            return;
+        }
+        const double eps2 = params.softening * params.softening;
+        const std::size_t row_tile = get_row_tile(target_count);
+        const std::size_t row_tiles = (target_count + row_tile - 1) / row_tile;
+
+        // each task owns its rows, so it can write straight into acc
+        Parallel::run(row_tiles, [&](std::size_t task, std::size_t) {
+            const std::size_t i_begin = task * row_tile;
+            const std::size_t i_end = std::min(target_count, i_begin + row_tile);
+            for (std::size_t j_begin = 0; j_begin < count; j_begin += tile_size_)
+            {
+                const std::size_t j_end = std::min(count, j_begin + tile_size_);
+                run_tile(target_x, target_y, i_begin, i_end, sources, j_begin, j_end, eps2, acc);
+            }
+        });
+        scale(acc, params.gravity);
+    }
+
+private:
+    [[nodiscard]] std::size_t get_row_tile(std::size_t rows) const
+    {
+        return std::clamp(rows / (Parallel::getThreadCount() * 4), MIN_ROW_TILE, tile_size_);
+    }
+
+    static void scale(Accelerations &acc, double factor)
+    {
+        for (std::size_t i = 0; i < acc.size(); ++i)
+        {
+            acc.x[i] *= factor;
+            acc.y[i] *= factor;
+        }
+    }
+
+    void run_tile(const double *tx, const double *ty, std::size_t i_begin, std::size_t i_end,
+        const Bodies &sources, std::size_t j_begin, std::size_t j_end, double eps2,
+        Accelerations &acc) const
+    {
+        const double *x = sources.x.data();
+        const double *y = sources.y.data();
+        const double *m = sources.mass.data();
+        double *acc_x = acc.x.data();
+        double *acc_y = acc.y.data();
+
+        switch (simd_level_)
+        {
+#if GRAVITY_X86_SIMD
+        case SimdLevel::Avx512:
+            Kernels::rowsAvx512(tx, ty, i_begin, i_end, x, y, m, j_begin, j_end, eps2, acc_x,
+                acc_y);
+            return;
+        case SimdLevel::Avx2:
+            Kernels::rowsAvx2(tx, ty, i_begin, i_end, x, y, m, j_begin, j_end, eps2, acc_x,
+                acc_y);
+            return;
+#endif
+        default:
+            Kernels::rowsScalar(tx, ty, i_begin, i_end, x, y, m, j_begin, j_end, eps2, acc_x,
+                acc_y);
+            return;
+        }
+    }
+
+    // Float offsets of one row tile of targets and one tile of sources from the center of
+    // the row tile.
+    struct MixedTile
+    {
+        std::vector<float> tx;
+        std::vector<float> ty;
+        std::vector<float> x;
+        std::vector<float> y;
+    };
+
+    // Every row tile converts its targets, and each source tile as it sweeps over it, to float
+    // offsets from the center of its own targets. The separations computed from them then
+    // carry rounding on the scale of the tile and the pair rather than of the whole system,
+    // wherever the tile sits. A source tile is converted once per row tile, which is small
+    // next to the pairs it feeds.
+    // That only holds for compact row tiles, so the targets are tiled in Morton order, and a
+    // tile also ends where the order leaves a cell of the MIXED_SPLIT_LEVEL grid over them;
+    // no tile straddles far-apart clusters whatever the input order.
+    void compute_mixed(const Bodies &sources, const double *target_x, const double *target_y,
+        std::size_t target_count, const Params &params, Accelerations &acc) const
+    {
+        const std::size_t count = sources.size();
+        mixed_mass_.resize(count);
+        Parallel::forRange(count, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t j = begin; j < end; ++j)
+            {
+                mixed_mass_[j] = static_cast<float>(sources.mass[j]);
+            }
+        });
+
+        sortByMortonCode(target_x, target_y, target_count, mixed_keys_);
+        const std::size_t row_tile = get_row_tile(target_count);
+        constexpr std::uint32_t CELL_SHIFT = 64 - 2 * MIXED_SPLIT_LEVEL;
+        mixed_tile_starts_.clear();
+        for (std::size_t k = 0; k < target_count; ++k)
+        {
+            if (mixed_tile_starts_.empty() || k - mixed_tile_starts_.back() == row_tile
+                || mixed_keys_[k] >> CELL_SHIFT
+                    != mixed_keys_[mixed_tile_starts_.back()] >> CELL_SHIFT)
+            {
+                mixed_tile_starts_.push_back(k);
+            }
+        }
+        mixed_tile_starts_.push_back(target_count);
+
+        const auto eps2 = static_cast<float>(params.softening * params.softening);
+        mixed_acc_.reset(target_count);
+        mixed_tiles_.resize(Parallel::getThreadCount());
+        Parallel::run(mixed_tile_starts_.size() - 1, [&](std::size_t task, std::size_t worker) {
+            const std::size_t k_begin = mixed_tile_starts_[task];
+            const std::size_t k_end = mixed_tile_starts_[task + 1];
+            double min_x = std::numeric_limits<double>::infinity();
+            double min_y = min_x;
+            double max_x = -min_x;
+            double max_y = -min_x;
+            for (std::size_t k = k_begin; k < k_end; ++k)
+            {
+                const auto i = static_cast<std::uint32_t>(mixed_keys_[k]);
+                min_x = std::min(min_x, target_x[i]);
+                min_y = std::min(min_y, target_y[i]);
+                max_x = std::max(max_x, target_x[i]);
+                max_y = std::max(max_y, target_y[i]);
+            }
+            const double origin_x = (min_x + max_x) * 0.5;
+            const double origin_y = (min_y + max_y) * 0.5;
+
+            MixedTile &tile = mixed_tiles_[worker];
+            tile.tx.resize(k_end - k_begin);
+            tile.ty.resize(k_end - k_begin);
+            for (std::size_t k = k_begin; k < k_end; ++k)
+            {
+                const auto i = static_cast<std::uint32_t>(mixed_keys_[k]);
+                tile.tx[k - k_begin] = static_cast<float>(target_x[i] - origin_x);
+                tile.ty[k - k_begin] = static_cast<float>(target_y[i] - origin_y);
+            }
+            tile.x.resize(tile_size_);
+            tile.y.resize(tile_size_);
+            for (std::size_t j_begin = 0; j_begin < count; j_begin += tile_size_)
+            {
+                const std::size_t j_end = std::min(count, j_begin + tile_size_);
+                for (std::size_t j = j_begin; j < j_end; ++j)
+                {
+                    tile.x[j - j_begin] = static_cast<float>(sources.x[j] - origin_x);
+                    tile.y[j - j_begin] = static_cast<float>(sources.y[j] - origin_y);
+                }
+                run_mixed_tile(tile, k_end - k_begin, mixed_mass_.data() + j_begin,
+                    j_end - j_begin, eps2, mixed_acc_.x.data() + k_begin,
+                    mixed_acc_.y.data() + k_begin);
+            }
+        });
+
+        // back to target order
+        Parallel::forRange(target_count, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t k = begin; k < end; ++k)
+            {
+                const auto i = static_cast<std::uint32_t>(mixed_keys_[k]);
+                acc.x[i] = mixed_acc_.x[k] * params.gravity;
+                acc.y[i] = mixed_acc_.y[k] * params.gravity;
+            }
+        });
+    }
+
+    // Adds the attraction of the sources of tile, with masses m, to its rows.
+    void run_mixed_tile(const MixedTile &tile, std::size_t rows, const float *m,
+        std::size_t columns, float eps2, double *acc_x, double *acc_y) const
+    {
+        const float *tx = tile.tx.data();
+        const float *ty = tile.ty.data();
+        const float *x = tile.x.data();
+        const float *y = tile.y.data();
+
+        switch (simd_level_)
+        {
+#if GRAVITY_X86_SIMD
+        case SimdLevel::Avx512:
+            Kernels::rowsMixedAvx512(tx, ty, 0, rows, x, y, m, 0, columns, eps2, acc_x, acc_y);
+            return;
+        case SimdLevel::Avx2:
+            Kernels::rowsMixedAvx2(tx, ty, 0, rows, x, y, m, 0, columns, eps2, acc_x, acc_y);
+            return;
+#endif
+        default:
+            Kernels::rowsMixedScalar(tx, ty, 0, rows, x, y, m, 0, columns, eps2, acc_x, acc_y);
+            return;
+        }
+    }
+
+    void run_symmetric_tile(const Bodies &bodies, std::size_t i_begin, std::size_t i_end,
+        std::size_t j_begin, std::size_t j_end, double eps2, Accelerations &acc) const
+    {
+        const double *x = bodies.x.data();
+        const double *y = bodies.y.data();
+        const double *m = bodies.mass.data();
+        double *acc_x = acc.x.data();
+        double *acc_y = acc.y.data();
+
+        switch (simd_level_)
+        {
+#if GRAVITY_X86_SIMD
+        case SimdLevel::Avx512:
+            Kernels::rowsSymmetricAvx512(x, y, m, i_begin, i_end, j_begin, j_end, eps2, acc_x,
+                acc_y);
+            return;
+        case SimdLevel::Avx2:
+            Kernels::rowsSymmetricAvx2(x, y, m, i_begin, i_end, j_begin, j_end, eps2, acc_x,
+                acc_y);
+            return;
+#endif
+        default:
+            Kernels::rowsSymmetricScalar(x, y, m, i_begin, i_end, j_begin, j_end, eps2, acc_x,
+                acc_y);
+            return;
+        }
+    }
+
+private:
+    SimdLevel simd_level_;
+    bool symmetric_{false};
+    Precision precision_{Precision::Double};
+    std::size_t tile_size_{DEFAULT_TILE_SIZE};
+    // per-worker accumulators of the symmetric mode
+    std::vector<Accelerations> worker_acc_;
+    // float masses, Morton-sorted targets, row tile bounds in that order, per-worker tiles
+    // and accelerations in that order of the mixed-precision mode
+    mutable std::vector<float> mixed_mass_;
+    mutable std::vector<std::uint64_t> mixed_keys_;
+    mutable std::vector<std::size_t> mixed_tile_starts_;
+    mutable std::vector<MixedTile> mixed_tiles_;
+    mutable Accelerations mixed_acc_;
+};
+
+} // namespace Gravity
@@ -1,85 +1,126 @@
 #pragma once
 
+#include "ArchetypeStorage.h"
+#include "ECSTypes.h"
+
+#include <algorithm>
 #include <array>
-#include <bitset>
 #include <cassert>
+#include <cstdint>
 #include <memory>
-#include <set>
+#include <tuple>
 #include <unordered_map>
-#include <unordered_set>
+#include <utility>
 #include <vector>
 
-
-template<class T>
-struct TypeInfo;
-
-#define DECLARE_TYPE_INFO(type)                                                                    \
-    template<>                                                                                     \
-    struct TypeInfo<type>                                                                          \
-    {                                                                                              \
-        static const char *toStr()                                                                 \
-        {                                                                                          \
-            return #type;                                                                          \
-        }                                                                                          \
-    }
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
 
 
-using Entity = int;
-
-using ComponentType = std::uint8_t;
-inline constexpr ComponentType MAX_COMPONENTS = 32;
-using Signature = std::bitset<MAX_COMPONENTS>;
-
 class EntityManager
 {
 public:
     [[nodiscard]] Entity createEntity()
     {
         Entity entity = get_free_entity();
-        entities_.push_back(entity);
-        entity_signatures_.emplace(entity, Signature{});
+        const std::uint32_t index = entityIndex(entity);
+        signatures_[index].reset();
+        alive_[index / 64] |= std::uint64_t{1} << (index % 64);
         return entity;
     }
 
     void removeEntity(Entity entity)
     {
-        auto it = std::find(entities_.begin(), entities_.end(), entity);
-        assert(it != entities_.end());
-        entities_.erase(it);
-        assert(entity_signatures_.find(entity) != entity_signatures_.end());
-        entity_signatures_.erase(entity);
+        assert(isAlive(entity));
+        const std::uint32_t index = entityIndex(entity);
+        slots_[index] = makeEntity(index, entityGeneration(entity) + 1);
+        free_indices_.push_back(index);
+        signatures_[index].reset();
+        alive_[index / 64] &= ~(std::uint64_t{1} << (index % 64));
+    }
+
+    [[nodiscard]] bool isAlive(Entity entity) const
+    {
+        // a free slot already holds the handle it will hand out next, so the bit decides
+        const std::uint32_t index = entityIndex(entity);
+        return index < slots_.size() && (alive_[index / 64] >> (index % 64) & 1) != 0
+            && slots_[index] == entity;
     }
 
     void setSignature(Entity entity, Signature signature)
     {
-        assert(std::find(entities_.begin(), entities_.end(), entity) != entities_.end());
-        assert(entity_signatures_.find(entity) != entity_signatures_.end());
-        entity_signatures_[entity] = signature;
+        assert(isAlive(entity));
+        signatures_[entityIndex(entity)] = signature;
     }
 
     [[nodiscard]] Signature getSignature(Entity entity) const
     {
-        assert(std::find(entities_.begin(), entities_.end(), entity) != entities_.end());
-        auto it = entity_signatures_.find(entity);
-        assert(it != entity_signatures_.end());
-        return it->second;
+        assert(isAlive(entity));
+        return signatures_[entityIndex(entity)];
+    }
+
+    // Calls func(entity) for every alive entity whose signature contains the given one.
+    // Walks the alive bitmap word by word, so dead ranges are skipped 64 slots at a time.
+    template<class F>
+    void forEachMatching(Signature signature, F &&func) const
+    {
+        for (std::size_t word_index = 0; word_index < alive_.size(); ++word_index)
+        {
+            std::uint64_t word = alive_[word_index];
+            while (word != 0)
+            {
+                const std::size_t index = word_index * 64 + count_trailing_zeros(word);
+                word &= word - 1;
+                if ((signatures_[index] & signature) == signature)
+                {
+                    func(slots_[index]);
+                }
+            }
+        }
     }
 
 private:
-    // TODO: optimize
-    [[nodiscard]] Entity get_free_entity() const
+    [[nodiscard]] Entity get_free_entity()
     {
-        Entity entity = 0;
-        while (std::find(entities_.begin(), entities_.end(), entity) != entities_.end())
+        if (!free_indices_.empty())
+        {
+            const std::uint32_t index = free_indices_.back();
+            free_indices_.pop_back();
+            return slots_[index];
+        }
+
+        assert(slots_.size() < MAX_ENTITIES);
+        const auto index = static_cast<std::uint32_t>(slots_.size());
+        const Entity entity = makeEntity(index, 0);
+        slots_.push_back(entity);
+        signatures_.emplace_back();
+        if (index % 64 == 0)
         {
-            entity++;
+            alive_.push_back(0);
         }
         return entity;
     }
 
+    static inline std::size_t count_trailing_zeros(std::uint64_t word)
+    {
+        assert(word != 0);
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return index;
+#else
+        return __builtin_ctzll(word);
+#endif
+    }
+
 private:
-    std::vector<Entity> entities_;
-    std::unordered_map<Entity, Signature> entity_signatures_;
+    // current handle of each slot; a free slot already holds its next generation
+    std::vector<Entity> slots_;
+    std::vector<std::uint32_t> free_indices_;
+    std::vector<Signature> signatures_;
+    // one bit per slot
+    std::vector<std::uint64_t> alive_;
 };
 
 
@@ -88,55 +129,150 @@ class IComponentArray
 public:
     virtual ~IComponentArray() = default;
     virtual void entityDestroyed(Entity entity) = 0;
+    virtual void entitiesDestroyed(const std::vector<Entity> &entities) = 0;
 };
 
+// Sparse set keyed by entity index: a paged sparse array maps the index to a slot in the
+// packed entity/component vectors. Lookup is two array loads, removal is swap-and-pop.
 template<class T>
 class ComponentArray final : public IComponentArray
 {
 public:
     void addData(Entity entity, T data)
     {
-        assert(entity_to_index_.find(entity) == entity_to_index_.end());
-        const int index = component_arr_.size();
-        component_arr_.push_back(data);
-        entity_to_index_[entity] = index;
-        index_to_entity_[index] = entity;
+        assert(!hasData(entity));
+        const auto index = static_cast<std::uint32_t>(component_arr_.size());
+        component_arr_.push_back(std::move(data));
+        dense_entities_.push_back(entity);
+        get_sparse_slot(entityIndex(entity)) = index;
     }
 
     void removeData(Entity entity)
     {
-        assert(entity_to_index_.find(entity) != entity_to_index_.end());
-        const int cur_index = entity_to_index_[entity];
-        const int last_index = component_arr_.size() - 1;
+        assert(hasData(entity));
+        std::uint32_t &cur_slot = sparse_pages_[page_of(entity)][offset_of(entity)];
+        const std::uint32_t cur_index = cur_slot;
+        const std::uint32_t last_index = component_arr_.size() - 1;
 
-        component_arr_[cur_index] = component_arr_[last_index];
+        if (cur_index != last_index)
+        {
+            const Entity last_ent = dense_entities_[last_index];
+            component_arr_[cur_index] = std::move(component_arr_[last_index]);
+            dense_entities_[cur_index] = last_ent;
+            sparse_pages_[page_of(last_ent)][offset_of(last_ent)] = cur_index;
+        }
         component_arr_.pop_back();
+        dense_entities_.pop_back();
+        cur_slot = INVALID_INDEX;
+    }
 
-        const Entity last_ent = index_to_entity_[last_index];
-        index_to_entity_[cur_index] = last_ent;
-        entity_to_index_[last_ent] = cur_index;
+    [[nodiscard]] bool hasData(Entity entity) const { return indexOf(entity) != INVALID_INDEX; }
 
-        index_to_entity_.erase(last_index);
-        entity_to_index_.erase(entity);
+    // Position of the entity in the packed arrays, or INVALID_INDEX if it has no data.
+    [[nodiscard]] std::uint32_t indexOf(Entity entity) const
+    {
+        const std::uint32_t page = page_of(entity);
+        if (page >= sparse_pages_.size() || !sparse_pages_[page])
+        {
+            return INVALID_INDEX;
+        }
+        const std::uint32_t index = sparse_pages_[page][offset_of(entity)];
+        return index != INVALID_INDEX && dense_entities_[index] == entity ? index : INVALID_INDEX;
     }
 
     T &getData(Entity entity)
     {
-        assert(entity_to_index_.find(entity) != entity_to_index_.end());
-        return component_arr_[entity_to_index_[entity]];
+        assert(hasData(entity));
+        return component_arr_[sparse_pages_[page_of(entity)][offset_of(entity)]];
     }
 
     void entityDestroyed(Entity entity) override
     {
-        if (entity_to_index_.find(entity) != entity_to_index_.end())
+        if (hasData(entity))
         {
             removeData(entity);
         }
     }
 
+    // Small batches are removed one swap-and-pop at a time; large ones are marked and then
+    // compacted in a single pass over the packed arrays, which also keeps their order.
+    void entitiesDestroyed(const std::vector<Entity> &entities) override
+    {
+        if (entities.size() * 8 < component_arr_.size())
+        {
+            for (const Entity entity : entities)
+            {
+                entityDestroyed(entity);
+            }
+            return;
+        }
+
+        for (const Entity entity : entities)
+        {
+            if (hasData(entity))
+            {
+                sparse_pages_[page_of(entity)][offset_of(entity)] = INVALID_INDEX;
+            }
+        }
+        std::uint32_t kept = 0;
+        for (std::uint32_t index = 0; index < component_arr_.size(); ++index)
+        {
+            const Entity entity = dense_entities_[index];
+            std::uint32_t &slot = sparse_pages_[page_of(entity)][offset_of(entity)];
+            if (slot == INVALID_INDEX)
+            {
+                continue;
+            }
+            if (kept != index)
+            {
+                component_arr_[kept] = std::move(component_arr_[index]);
+                dense_entities_[kept] = entity;
+                slot = kept;
+            }
+            kept++;
+        }
+        component_arr_.erase(component_arr_.begin() + kept, component_arr_.end());
+        dense_entities_.resize(kept);
+    }
+
+    T &getDataAt(std::uint32_t index)
+    {
+        assert(index < component_arr_.size());
+        return component_arr_[index];
+    }
+
+    [[nodiscard]] std::size_t size() const { return component_arr_.size(); }
+
+    // Packed arrays; getEntities()[i] owns getRawData()[i].
+    [[nodiscard]] const std::vector<Entity> &getEntities() const { return dense_entities_; }
+    [[nodiscard]] std::vector<T> &getRawData() { return component_arr_; }
+
+    static constexpr std::uint32_t INVALID_INDEX = ~std::uint32_t{0};
+
+private:
+    static constexpr std::uint32_t PAGE_SIZE = 4096;
+
+    static inline std::uint32_t page_of(Entity entity) { return entityIndex(entity) / PAGE_SIZE; }
+    static inline std::uint32_t offset_of(Entity entity) { return entityIndex(entity) % PAGE_SIZE; }
+
+    std::uint32_t &get_sparse_slot(std::uint32_t entity_index)
+    {
+        const std::uint32_t page = entity_index / PAGE_SIZE;
+        if (page >= sparse_pages_.size())
+        {
+            sparse_pages_.resize(page + 1);
+        }
+        if (!sparse_pages_[page])
+        {
+            sparse_pages_[page] = std::make_unique<std::uint32_t[]>(PAGE_SIZE);
+            std::fill_n(sparse_pages_[page].get(), PAGE_SIZE, INVALID_INDEX);
+        }
+        return sparse_pages_[page][entity_index % PAGE_SIZE];
+    }
+
 private:
-    std::unordered_map<Entity, int> entity_to_index_;
-    std::unordered_map<int, Entity> index_to_entity_;
+    std::vector<std::unique_ptr<std::uint32_t[]>> sparse_pages_;
+    std::vector<Entity> dense_entities_;
     std::vector<T> component_arr_;
 };
 
@@ -147,238 +283,716 @@ public:
     template<class T>
     void registerComponent()
     {
-        const char *type = get_component_type<T>();
-        assert(component_arrays_.find(type) == component_arrays_.end());
+        const std::size_t id = get_component_id<T>();
+        if (id >= component_arrays_.size())
+        {
+            component_arrays_.resize(id + 1);
+            component_types_.resize(id + 1, INVALID_COMPONENT_TYPE);
+        }
+        assert(!component_arrays_[id]);
         assert(next_component_type < MAX_COMPONENTS);
-        component_arrays_.emplace(type, std::make_unique<ComponentArray<T>>());
-        component_types_.emplace(type, next_component_type);
+        component_arrays_[id] = std::make_unique<ComponentArray<T>>();
+        component_types_[id] = next_component_type;
         next_component_type++;
     }
 
     template<class T>
     [[nodiscard]] ComponentType getComponentType() const
     {
-        const char *type = get_component_type<T>();
-        auto it = component_types_.find(type);
-        assert(it != component_types_.end());
-        return it->second;
+        const std::size_t id = get_component_id<T>();
+        assert(id < component_types_.size() && component_types_[id] != INVALID_COMPONENT_TYPE);
+        return component_types_[id];
     }
 
     template<class T>
     void addComponent(Entity entity, T component)
     {
-        const char *type = get_component_type<T>();
-        assert(component_arrays_.find(type) != component_arrays_.end());
-        get_component_array<T>()->addData(entity, component);
+        getComponentArray<T>()->addData(entity, component);
     }
 
     template<class T>
     void removeComponent(Entity entity)
     {
-        const char *type = get_component_type<T>();
-        assert(component_arrays_.find(type) != component_arrays_.end());
-        get_component_array<T>()->removeData(entity);
+        getComponentArray<T>()->removeData(entity);
     }
 
     template<class T>
     [[nodiscard]] T &getComponent(Entity entity) const
     {
-        const char *type = get_component_type<T>();
-        assert(component_arrays_.find(type) != component_arrays_.end());
-        return get_component_array<T>()->getData(entity);
+        return getComponentArray<T>()->getData(entity);
+    }
+
+    template<class T>
+    [[nodiscard]] ComponentArray<T> *getComponentArray() const
+    {
+        const std::size_t id = get_component_id<T>();
+        assert(id < component_arrays_.size() && component_arrays_[id]);
+        assert(dynamic_cast<ComponentArray<T> *>(component_arrays_[id].get()));
+        return static_cast<ComponentArray<T> *>(component_arrays_[id].get());
     }
 
     void entityDestroyed(Entity entity)
     {
-        for (const auto &it : component_arrays_)
+        for (const auto &array : component_arrays_)
         {
-            it.second->entityDestroyed(entity);
+            if (array)
+            {
+                array->entityDestroyed(entity);
+            }
         }
     }
 
-private:
-    template<class T>
-    static inline const char *get_component_type()
+    void entitiesDestroyed(const std::vector<Entity> &entities)
     {
-        return TypeInfo<T>::toStr();
+        for (const auto &array : component_arrays_)
+        {
+            if (array)
+            {
+                array->entitiesDestroyed(entities);
+            }
+        }
     }
 
+private:
+    static constexpr ComponentType INVALID_COMPONENT_TYPE = ~ComponentType{0};
+
     template<class T>
-    [[nodiscard]] ComponentArray<T> *get_component_array() const
+    static inline std::size_t get_component_id()
     {
-        const char *type = get_component_type<T>();
-        assert(component_arrays_.find(type) != component_arrays_.end());
-        auto it = component_arrays_.find(type);
-        assert(it != component_arrays_.end());
-        assert(dynamic_cast<ComponentArray<T> *>(it->second.get()));
-        return static_cast<ComponentArray<T> *>(it->second.get());
+        return TypeId<ComponentFamily>::get<T>();
     }
 
 private:
     using ComponentArrayPtr = std::unique_ptr<IComponentArray>;
-    std::unordered_map<const char *, ComponentArrayPtr> component_arrays_;
-    std::unordered_map<const char *, ComponentType> component_types_;
+    // both indexed by TypeId<ComponentFamily>
+    std::vector<ComponentArrayPtr> component_arrays_;
+    std::vector<ComponentType> component_types_;
     ComponentType next_component_type = 0;
 };
 
 
+// Iterates every entity that has all of Comps, yielding (Entity, Comps &...).
+// With sparse sets the smallest participating array drives the loop; its own data is
+// addressed by the loop index and the other arrays are resolved with one sparse lookup each.
+// With archetype storage the view walks the chunks of every matching archetype in turn; the
+// chunks are listed once when the view is created, so a range seeks its first chunk in
+// O(log chunks).
+// Adding or removing any of Comps while iterating is not allowed.
+template<class... Comps>
+class View
+{
+public:
+    explicit View(ComponentArray<Comps> *...arrays)
+        : arrays_{arrays...}
+    {}
+
+    explicit View(ArchetypeStorage *archetypes)
+        : archetypes_(archetypes)
+    {
+        std::size_t base = 0;
+        archetypes_->forEachChunk<Comps...>(
+            [&](std::uint32_t count, const Entity *entities, Comps *...columns) {
+                chunks_.push_back(ChunkSlice{base, count, entities, {columns...}});
+                base += count;
+            });
+        chunk_total_ = base;
+    }
+
+    template<class F>
+    void each(F &&func) const
+    {
+        if (archetypes_ != nullptr)
+        {
+            archetypes_->forEach<Comps...>(func);
+            return;
+        }
+        eachInRange(0, sizeHint(), [&func](std::size_t, Entity entity, Comps &...components) {
+            func(entity, components...);
+        });
+    }
+
+    // Calls func(count, entities, Comps *...) for runs of entities that have all of Comps and
+    // the same signature; every pointer addresses count contiguous elements. With archetype
+    // storage a run is a whole chunk, with sparse sets every entity is a run of its own.
+    template<class F>
+    void eachChunk(F &&func) const
+    {
+        if (archetypes_ != nullptr)
+        {
+            archetypes_->forEachChunk<Comps...>(func);
+            return;
+        }
+        each([&func](Entity entity, Comps &...components) {
+            func(std::uint32_t{1}, &entity, &components...);
+        });
+    }
+
+    // Like each, over the slots [begin, end) of [0, sizeHint()) only, passing the slot first:
+    // func(slot, entity, comps...). Slots are fixed while the arrays are not modified, so
+    // disjoint ranges may be walked concurrently, writing to per-slot outputs.
+    template<class F>
+    void eachInRange(std::size_t begin, std::size_t end, F &&func) const
+    {
+        if (archetypes_ != nullptr)
+        {
+            // slots number the entities in chunk order
+            auto chunk = std::upper_bound(chunks_.begin(), chunks_.end(), begin,
+                [](std::size_t slot, const ChunkSlice &slice) { return slot < slice.base; });
+            if (chunk != chunks_.begin())
+            {
+                --chunk;
+            }
+            for (; chunk != chunks_.end() && chunk->base < end; ++chunk)
+            {
+                each_in_chunk(func, *chunk, begin, end, std::index_sequence_for<Comps...>{});
+            }
+        }
+        else if constexpr (sizeof...(Comps) == 1)
+        {
+            // single component: walk the packed arrays directly
+            auto *array = std::get<0>(arrays_);
+            const std::vector<Entity> &entities = array->getEntities();
+            auto &data = array->getRawData();
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                func(i, entities[i], data[i]);
+            }
+        }
+        else
+        {
+            each_driven_by(func, get_smallest(), begin, end, std::index_sequence_for<Comps...>{});
+        }
+    }
+
+    // Upper bound of the number of entities the view yields.
+    [[nodiscard]] std::size_t sizeHint() const
+    {
+        if (archetypes_ != nullptr)
+        {
+            return chunk_total_;
+        }
+        return std::min({std::get<ComponentArray<Comps> *>(arrays_)->size()...});
+    }
+
+private:
+    // a chunk of a matching archetype and the slot of its first entity
+    struct ChunkSlice
+    {
+        std::size_t base;
+        std::uint32_t count;
+        const Entity *entities;
+        std::tuple<Comps *...> columns;
+    };
+
+    template<class F, std::size_t... I>
+    static void each_in_chunk(F &func, const ChunkSlice &chunk, std::size_t begin,
+        std::size_t end, std::index_sequence<I...>)
+    {
+        const std::size_t last = std::min(end, chunk.base + chunk.count);
+        for (std::size_t i = std::max(begin, chunk.base); i < last; ++i)
+        {
+            const std::size_t row = i - chunk.base;
+            func(i, chunk.entities[row], std::get<I>(chunk.columns)[row]...);
+        }
+    }
+
+    [[nodiscard]] std::size_t get_smallest() const
+    {
+        const std::array<std::size_t, sizeof...(Comps)> sizes{
+            std::get<ComponentArray<Comps> *>(arrays_)->size()...};
+        return std::min_element(sizes.begin(), sizes.end()) - sizes.begin();
+    }
+
+    template<class F, std::size_t... I>
+    void each_driven_by(F &func, std::size_t pivot, std::size_t begin, std::size_t end,
+        std::index_sequence<I...>) const
+    {
+        const std::array<const std::vector<Entity> *, sizeof...(Comps)> entity_lists{
+            &std::get<I>(arrays_)->getEntities()...};
+        const std::vector<Entity> &entities = *entity_lists[pivot];
+
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            const Entity entity = entities[i];
+            const std::array<std::uint32_t, sizeof...(Comps)> indices{(I == pivot
+                    ? static_cast<std::uint32_t>(i)
+                    : std::get<I>(arrays_)->indexOf(entity))...};
+            if (((indices[I] == ComponentArray<Comps>::INVALID_INDEX) || ...))
+            {
+                continue;
+            }
+            func(i, entity, std::get<I>(arrays_)->getDataAt(indices[I])...);
+        }
+    }
+
+private:
+    // null with archetype storage
+    std::tuple<ComponentArray<Comps> *...> arrays_;
+    // null with sparse sets
+    ArchetypeStorage *archetypes_{nullptr};
+    // empty with sparse sets
+    std::vector<ChunkSlice> chunks_;
+    std::size_t chunk_total_{0};
+};
+
+
+// Sparse set of entity handles: iteration is a walk over a packed vector, insert and erase
+// are O(1) and only allocate while the set grows past its previous size.
+class EntitySet
+{
+public:
+    bool insert(Entity entity)
+    {
+        if (contains(entity))
+        {
+            return false;
+        }
+        const std::uint32_t index = entityIndex(entity);
+        if (index >= sparse_.size())
+        {
+            sparse_.resize(index + 1, INVALID_INDEX);
+        }
+        sparse_[index] = static_cast<std::uint32_t>(dense_.size());
+        dense_.push_back(entity);
+        return true;
+    }
+
+    bool erase(Entity entity)
+    {
+        if (!contains(entity))
+        {
+            return false;
+        }
+        const std::uint32_t index = entityIndex(entity);
+        const std::uint32_t pos = sparse_[index];
+        const Entity last = dense_.back();
+        dense_[pos] = last;
+        sparse_[entityIndex(last)] = pos;
+        dense_.pop_back();
+        sparse_[index] = INVALID_INDEX;
+        return true;
+    }
+
+    [[nodiscard]] bool contains(Entity entity) const
+    {
+        const std::uint32_t index = entityIndex(entity);
+        return index < sparse_.size() && sparse_[index] != INVALID_INDEX
+            && dense_[sparse_[index]] == entity;
+    }
+
+    [[nodiscard]] std::size_t size() const { return dense_.size(); }
+    [[nodiscard]] bool empty() const { return dense_.empty(); }
+    [[nodiscard]] const Entity *data() const { return dense_.data(); }
+
+    [[nodiscard]] std::vector<Entity>::const_iterator begin() const { return dense_.begin(); }
+    [[nodiscard]] std::vector<Entity>::const_iterator end() const { return dense_.end(); }
+
+private:
+    static constexpr std::uint32_t INVALID_INDEX = ~std::uint32_t{0};
+
+    std::vector<std::uint32_t> sparse_;
+    std::vector<Entity> dense_;
+};
+
+
 class System
 {
 public:
     virtual ~System() = default;
 
-    void addEntity(Entity entity) { entities_.emplace(entity); }
+    void addEntity(Entity entity) { entities_.insert(entity); }
 
     void removeEntity(Entity entity) { entities_.erase(entity); }
 
     void entityDestroyed(Entity entity) { removeEntity(entity); }
 
+    [[nodiscard]] const EntitySet &getEntities() const { return entities_; }
+
 protected:
-    std::set<Entity> entities_;
+    EntitySet entities_;
 };
 
 
 class SystemManager
 {
 public:
+    static constexpr std::size_t MAX_SYSTEMS = 64;
+
     template<class T>
     T *registerSystem()
     {
-        const char *type = get_system_type<T>();
-        assert(systems_.find(type) == systems_.end());
-        auto it = systems_.emplace(type, std::make_unique<T>());
-        system_signatures_.emplace(type, Signature{});
-        return static_cast<T *>(it.first->second.get());
+        const std::size_t id = get_system_id<T>();
+        assert(id < MAX_SYSTEMS);
+        if (id >= systems_.size())
+        {
+            systems_.resize(id + 1);
+            system_signatures_.resize(id + 1);
+        }
+        assert(!systems_[id]);
+        systems_[id] = std::make_unique<T>();
+        system_signatures_[id] = Signature{};
+        rebuild_dispatch_index();
+        return static_cast<T *>(systems_[id].get());
     }
 
     template<class T>
     [[nodiscard]] T *getSystem()
     {
-        const char *type = get_system_type<T>();
-        auto it = systems_.find(type);
-        assert(it != systems_.end());
-        assert(dynamic_cast<T *>(it->second.get()));
-        return static_cast<T *>(it->second.get());
+        const std::size_t id = get_system_id<T>();
+        assert(id < systems_.size() && systems_[id]);
+        assert(dynamic_cast<T *>(systems_[id].get()));
+        return static_cast<T *>(systems_[id].get());
     }
 
     template<class T>
     void removeSystem()
     {
-        const char *type = get_system_type<T>();
-
-        auto it = systems_.find(type);
-        assert(it != systems_.end());
-        assert(dynamic_cast<T *>(it->second.get()));
-        systems_.erase(it);
-
-        auto it2 = system_signatures_.find(type);
-        assert(it2 != system_signatures_.end());
-        system_signatures_.erase(it2);
+        const std::size_t id = get_system_id<T>();
+        assert(id < systems_.size() && systems_[id]);
+        assert(dynamic_cast<T *>(systems_[id].get()));
+        systems_[id].reset();
+        system_signatures_[id] = Signature{};
+
+        const SystemMask bit = SystemMask{1} << id;
+        for (SystemMask &mask : entity_systems_)
+        {
+            mask &= ~bit;
+        }
+        rebuild_dispatch_index();
     }
 
+    // Existing entities join or leave the system to match the new signature. The joining ones
+    // are found with one scan over the alive bitmap and signature table of entities.
     template<class T>
-    void setSignature(Signature signature)
+    void setSignature(Signature signature, const EntityManager &entities)
     {
-        const char *type = get_system_type<T>();
-        assert(systems_.find(type) != systems_.end());
-        assert(system_signatures_.find(type) != system_signatures_.end());
-        system_signatures_[type] = signature;
+        const std::size_t id = get_system_id<T>();
+        assert(id < systems_.size() && systems_[id]);
+        system_signatures_[id] = signature;
+        rebuild_dispatch_index();
+
+        System &system = *systems_[id];
+        const SystemMask bit = SystemMask{1} << id;
+        std::vector<Entity> leaving;
+        for (const Entity entity : system.getEntities())
+        {
+            if ((entities.getSignature(entity) & signature) != signature)
+            {
+                leaving.push_back(entity);
+            }
+        }
+        for (const Entity entity : leaving)
+        {
+            system.removeEntity(entity);
+            entity_systems_[entityIndex(entity)] &= ~bit;
+        }
+        entities.forEachMatching(signature, [&](Entity entity) {
+            const std::uint32_t index = entityIndex(entity);
+            if (index >= entity_systems_.size())
+            {
+                entity_systems_.resize(index + 1, 0);
+            }
+            if ((entity_systems_[index] & bit) == 0)
+            {
+                system.addEntity(entity);
+                entity_systems_[index] |= bit;
+            }
+        });
     }
 
     void entityDestroyed(Entity entity)
     {
-        for (const auto &it : systems_)
+        const std::uint32_t index = entityIndex(entity);
+        if (index >= entity_systems_.size())
         {
-            it.second->entityDestroyed(entity);
+            return;
         }
+        for_each_bit(entity_systems_[index], [&](std::size_t id) {
+            systems_[id]->entityDestroyed(entity);
+        });
+        entity_systems_[index] = 0;
     }
 
-    void entitySignatureChanged(Entity entity, Signature entity_signature)
+    // Only the systems that depend on a changed component bit are visited, and a system is
+    // touched only when the entity actually enters or leaves it.
+    void entitySignatureChanged(Entity entity, Signature old_signature, Signature new_signature)
     {
-        for (const auto &it : systems_)
+        const std::uint32_t index = entityIndex(entity);
+        if (index >= entity_systems_.size())
         {
-            const auto &system = it.second;
-            const auto &system_signature = system_signatures_[it.first];
+            entity_systems_.resize(index + 1, 0);
+        }
+        SystemMask &membership = entity_systems_[index];
 
-            if ((entity_signature & system_signature) == system_signature)
+        SystemMask candidates = wildcard_systems_;
+        const Signature changed = old_signature ^ new_signature;
+        for (ComponentType type = 0; type < MAX_COMPONENTS; ++type)
+        {
+            if (changed.test(type))
+            {
+                candidates |= component_systems_[type];
+            }
+        }
+
+        for_each_bit(candidates, [&](std::size_t id) {
+            const Signature &system_signature = system_signatures_[id];
+            const bool matches = (new_signature & system_signature) == system_signature;
+            const SystemMask bit = SystemMask{1} << id;
+            if (matches == ((membership & bit) != 0))
+            {
+                return;
+            }
+            if (matches)
             {
-                system->addEntity(entity);
+                systems_[id]->addEntity(entity);
+                membership |= bit;
             }
             else
             {
-                system->removeEntity(entity);
+                systems_[id]->removeEntity(entity);
+                membership &= ~bit;
             }
-        }
+        });
     }
 
 private:
+    using SystemMask = std::uint64_t;
+
     template<class T>
-    static inline const char *get_system_type()
+    static inline std::size_t get_system_id()
+    {
+        return TypeId<SystemFamily>::get<T>();
+    }
+
+    template<class F>
+    static void for_each_bit(SystemMask mask, F &&func)
+    {
+        for (std::size_t id = 0; mask != 0; ++id, mask >>= 1)
+        {
+            if (mask & 1)
+            {
+                func(id);
+            }
+        }
+    }
+
+    void rebuild_dispatch_index()
     {
-        return TypeInfo<T>::toStr();
+        component_systems_.fill(0);
+        wildcard_systems_ = 0;
+        for (std::size_t id = 0; id < systems_.size(); ++id)
+        {
+            if (!systems_[id])
+            {
+                continue;
+            }
+            const SystemMask bit = SystemMask{1} << id;
+            const Signature &signature = system_signatures_[id];
+            if (signature.none())
+            {
+                wildcard_systems_ |= bit;
+            }
+            for (ComponentType type = 0; type < MAX_COMPONENTS; ++type)
+            {
+                if (signature.test(type))
+                {
+                    component_systems_[type] |= bit;
+                }
+            }
+        }
     }
 
 private:
     using SystemPtr = std::unique_ptr<System>;
-    std::unordered_map<const char *, SystemPtr> systems_;
-    std::unordered_map<const char *, Signature> system_signatures_;
+    // both indexed by TypeId<SystemFamily>
+    std::vector<SystemPtr> systems_;
+    std::vector<Signature> system_signatures_;
+
+    // systems whose signature contains the component bit
+    std::array<SystemMask, MAX_COMPONENTS> component_systems_{};
+    // systems with an empty signature accept every entity that changes its signature
+    SystemMask wildcard_systems_ = 0;
+    // systems each entity currently belongs to, indexed by entityIndex()
+    std::vector<SystemMask> entity_systems_;
+};
+
+
+// Where ECS keeps the component data.
+enum class ComponentStorage
+{
+    // one sparse set per component type (ComponentArray); adding and removing is cheapest
+    SparseSet,
+    // entities of the same signature packed into chunks of columns (ArchetypeStorage), so
+    // iterating several components of the same entities is a sequential walk over memory
+    Archetype,
 };
 
 
 class ECS
 {
 public:
-    [[nodiscard]] Entity createEntity() { return entity_manager_.createEntity(); }
+    explicit ECS(ComponentStorage storage = ComponentStorage::SparseSet)
+    {
+        if (storage == ComponentStorage::Archetype)
+        {
+            archetypes_ = std::make_unique<ArchetypeStorage>();
+        }
+    }
+
+    [[nodiscard]] ComponentStorage getStorage() const
+    {
+        return archetypes_ ? ComponentStorage::Archetype : ComponentStorage::SparseSet;
+    }
+
+    [[nodiscard]] Entity createEntity()
+    {
+        const Entity entity = entity_manager_.createEntity();
+        if (archetypes_)
+        {
+            archetypes_->entityCreated(entity);
+        }
+        return entity;
+    }
+
+    [[nodiscard]] bool isAlive(Entity entity) const { return entity_manager_.isAlive(entity); }
 
     void destroyEntity(Entity entity)
     {
         entity_manager_.removeEntity(entity);
-        component_manager_.entityDestroyed(entity);
+        if (archetypes_)
+        {
+            archetypes_->entityDestroyed(entity);
+        }
+        else
+        {
+            component_manager_.entityDestroyed(entity);
+        }
         system_manager_.entityDestroyed(entity);
     }
 
+    // Destroys a batch of distinct entities. Every component array is visited once for the
+    // whole batch rather than once per entity.
+    void destroyEntities(const std::vector<Entity> &entities)
+    {
+        for (const Entity entity : entities)
+        {
+            system_manager_.entityDestroyed(entity);
+        }
+        if (archetypes_)
+        {
+            for (const Entity entity : entities)
+            {
+                archetypes_->entityDestroyed(entity);
+            }
+        }
+        else
+        {
+            component_manager_.entitiesDestroyed(entities);
+        }
+        for (const Entity entity : entities)
+        {
+            entity_manager_.removeEntity(entity);
+        }
+    }
+
+    // The ComponentManager hands out the component types in both storages.
     template<class T>
     void registerComponent()
     {
         component_manager_.registerComponent<T>();
+        if (archetypes_)
+        {
+            archetypes_->registerComponent<T>();
+            assert(archetypes_->getComponentType<T>() == component_manager_.getComponentType<T>());
+        }
     }
 
     template<class... Comps>
     void registerComponents()
     {
-        ComponentsRegistrator<Comps...>::registerComponents(component_manager_);
+        (registerComponent<Comps>(), ...);
     }
 
     template<class T>
     void addComponent(Entity entity, T component)
     {
-        component_manager_.addComponent<T>(entity, component);
+        if (archetypes_)
+        {
+            archetypes_->addComponent<T>(entity, std::move(component));
+        }
+        else
+        {
+            component_manager_.addComponent<T>(entity, std::move(component));
+        }
 
-        Signature signature = entity_manager_.getSignature(entity);
+        const Signature old_signature = entity_manager_.getSignature(entity);
+        Signature signature = old_signature;
         signature.set(component_manager_.getComponentType<T>(), true);
         entity_manager_.setSignature(entity, signature);
 
-        system_manager_.entitySignatureChanged(entity, signature);
+        system_manager_.entitySignatureChanged(entity, old_signature, signature);
     }
 
     template<class T>
     void removeComponent(Entity entity)
     {
-        component_manager_.removeComponent<T>(entity);
+        if (archetypes_)
+        {
+            archetypes_->removeComponent<T>(entity);
+        }
+        else
+        {
+            component_manager_.removeComponent<T>(entity);
+        }
 
-        Signature signature = entity_manager_.getSignature(entity);
+        const Signature old_signature = entity_manager_.getSignature(entity);
+        Signature signature = old_signature;
         signature.set(component_manager_.getComponentType<T>(), false);
         entity_manager_.setSignature(entity, signature);
 
-        system_manager_.entitySignatureChanged(entity, signature);
+        system_manager_.entitySignatureChanged(entity, old_signature, signature);
     }
 
     template<class T>
     [[nodiscard]] T &getComponent(Entity entity)
     {
+        if (archetypes_)
+        {
+            return archetypes_->getComponent<T>(entity);
+        }
         return component_manager_.getComponent<T>(entity);
     }
 
+    template<class T>
+    [[nodiscard]] bool hasComponent(Entity entity) const
+    {
+        return entity_manager_.getSignature(entity).test(component_manager_.getComponentType<T>());
+    }
+
+    template<class... Comps>
+    [[nodiscard]] View<Comps...> view()
+    {
+        if (archetypes_)
+        {
+            return View<Comps...>(archetypes_.get());
+        }
+        return View<Comps...>(component_manager_.getComponentArray<Comps>()...);
+    }
+
+    // Shorthand for view<Comps...>().each(func).
+    template<class... Comps, class F>
+    void each(F &&func)
+    {
+        view<Comps...>().each(std::forward<F>(func));
+    }
+
+    // Shorthand for view<Comps...>().eachChunk(func).
+    template<class... Comps, class F>
+    void eachChunk(F &&func)
+    {
+        view<Comps...>().eachChunk(std::forward<F>(func));
+    }
+
     template<class T>
     ComponentType getComponentType()
     {
@@ -408,7 +1022,7 @@ public:
     template<class T>
     void setSystemSignature(Signature signature)
     {
-        system_manager_.setSignature<T>(signature);
+        system_manager_.setSignature<T>(signature, entity_manager_);
     }
 
     template<class T, class... Comps>
@@ -439,28 +1053,11 @@ private:
         }
     };
 
-    //////////////////////////////////////////////////
-    template<class... Comps>
-    struct ComponentsRegistrator;
-
-    template<>
-    struct ComponentsRegistrator<>
-    {
-        static void registerComponents(ComponentManager &cm) {}
-    };
-
-    template<class First, class... Tail>
-    struct ComponentsRegistrator<First, Tail...>
-    {
-        static void registerComponents(ComponentManager &cm)
-        {
-            cm.registerComponent<First>();
-            ComponentsRegistrator<Tail...>::registerComponents(cm);
-        }
-    };
-
 private:
     EntityManager entity_manager_;
+    // holds the data with sparse sets, and the component types in either case
     ComponentManager component_manager_;
+    // null with sparse sets
+    std::unique_ptr<ArchetypeStorage> archetypes_;
     SystemManager system_manager_;
 };
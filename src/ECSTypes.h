@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+
+// Dense type ids per family: TypeId<ComponentFamily>::get<Position>().
+// Every id is a static data member, initialized before main in no particular order, so a
+// lookup is a plain load with no initialization guard. Ids must not be asked for from the
+// initializer of another static object.
+template<class Family>
+class TypeId
+{
+public:
+    template<class T>
+    static std::size_t get()
+    {
+        return Id<T>::value;
+    }
+
+private:
+    static inline std::atomic<std::size_t> counter_{0};
+
+    template<class T>
+    struct Id
+    {
+        static inline const std::size_t value = counter_++;
+    };
+};
+
+struct ComponentFamily;
+struct SystemFamily;
+
+
+// Entity handle: low bits are the slot index, high bits are the slot generation.
+// The generation is bumped every time the slot is freed, so stale handles never compare
+// equal to a live one.
+using Entity = std::uint32_t;
+
+inline constexpr std::uint32_t ENTITY_INDEX_BITS = 24;
+inline constexpr std::uint32_t ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+inline constexpr std::uint32_t ENTITY_GENERATION_MASK = ~ENTITY_INDEX_MASK >> ENTITY_INDEX_BITS;
+inline constexpr std::uint32_t MAX_ENTITIES = ENTITY_INDEX_MASK;
+inline constexpr Entity NULL_ENTITY = ~Entity{0};
+
+inline constexpr std::uint32_t entityIndex(Entity entity)
+{
+    return entity & ENTITY_INDEX_MASK;
+}
+
+inline constexpr std::uint32_t entityGeneration(Entity entity)
+{
+    return entity >> ENTITY_INDEX_BITS;
+}
+
+inline constexpr Entity makeEntity(std::uint32_t index, std::uint32_t generation)
+{
+    return (generation & ENTITY_GENERATION_MASK) << ENTITY_INDEX_BITS | (index & ENTITY_INDEX_MASK);
+}
+
+using ComponentType = std::uint8_t;
+inline constexpr ComponentType MAX_COMPONENTS = 32;
+using Signature = std::bitset<MAX_COMPONENTS>;
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Math
+{
+
+// Iterative radix-2 FFT for one power-of-two size, with precomputed twiddles and bit-reversal
+// permutation. The inverse transform is not scaled by 1/size.
+class Fft
+{
+public:
+    using Complex = std::complex<double>;
+
+    Fft() = default;
+    explicit Fft(std::size_t size) { resize(size); }
+
+    void resize(std::size_t size)
+    {
+        assert(size > 0 && (size & (size - 1)) == 0);
+        size_ = size;
+
+        std::size_t bits = 0;
+        while ((std::size_t{1} << bits) < size)
+        {
+            bits++;
+        }
+        bit_reverse_.resize(size);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            std::size_t reversed = 0;
+            for (std::size_t bit = 0; bit < bits; ++bit)
+            {
+                reversed |= (i >> bit & 1) << (bits - 1 - bit);
+            }
+            bit_reverse_[i] = static_cast<std::uint32_t>(reversed);
+        }
+
+        const double pi = std::acos(-1.0);
+        twiddles_.resize(size / 2);
+        for (std::size_t k = 0; k < size / 2; ++k)
+        {
+            twiddles_[k] = std::polar(1.0, -2.0 * pi * k / size);
+        }
+    }
+
+    [[nodiscard]] std::size_t size() const { return size_; }
+
+    // Transforms size() contiguous values in place.
+    void transform(Complex *data, bool inverse) const
+    {
+        for (std::size_t i = 0; i < size_; ++i)
+        {
+            const std::size_t j = bit_reverse_[i];
+            if (i < j)
+            {
+                std::swap(data[i], data[j]);
+            }
+        }
+
+        for (std::size_t half = 1; half < size_; half *= 2)
+        {
+            const std::size_t twiddle_stride = size_ / (2 * half);
+            for (std::size_t block = 0; block < size_; block += 2 * half)
+            {
+                for (std::size_t k = 0; k < half; ++k)
+                {
+                    const Complex twiddle = inverse ? std::conj(twiddles_[k * twiddle_stride])
+                                                    : twiddles_[k * twiddle_stride];
+                    const Complex odd = data[block + k + half] * twiddle;
+                    data[block + k + half] = data[block + k] - odd;
+                    data[block + k] += odd;
+                }
+            }
+        }
+    }
+
+    // Transforms a row-major size() x size() grid in place, rows and then columns, both in
+    // parallel.
+    void transform2d(std::vector<Complex> &grid, bool inverse)
+    {
+        assert(grid.size() == size_ * size_);
+        Parallel::forEach(
+            size_, [&](std::size_t row) { transform(grid.data() + row * size_, inverse); }, 4);
+
+        // columns are gathered into per-worker scratch rows, a few at a time to reuse the
+        // cache lines of the grid
+        constexpr std::size_t COLUMN_BLOCK = 8;
+        columns_.resize(Parallel::getThreadCount());
+        const std::size_t blocks = (size_ + COLUMN_BLOCK - 1) / COLUMN_BLOCK;
+        Parallel::run(blocks, [&](std::size_t block, std::size_t worker) {
+            std::vector<Complex> &scratch = columns_[worker];
+            scratch.resize(size_ * COLUMN_BLOCK);
+            const std::size_t first = block * COLUMN_BLOCK;
+            const std::size_t width = std::min(COLUMN_BLOCK, size_ - first);
+            for (std::size_t row = 0; row < size_; ++row)
+            {
+                for (std::size_t c = 0; c < width; ++c)
+                {
+                    scratch[c * size_ + row] = grid[row * size_ + first + c];
+                }
+            }
+            for (std::size_t c = 0; c < width; ++c)
+            {
+                transform(scratch.data() + c * size_, inverse);
+            }
+            for (std::size_t row = 0; row < size_; ++row)
+            {
+                for (std::size_t c = 0; c < width; ++c)
+                {
+                    grid[row * size_ + first + c] = scratch[c * size_ + row];
+                }
+            }
+        });
+    }
+
+private:
+    std::size_t size_{0};
+    std::vector<std::uint32_t> bit_reverse_;
+    std::vector<Complex> twiddles_;
+    // per-worker column buffers of transform2d
+    std::vector<std::vector<Complex>> columns_;
+};
+
+} // namespace Math
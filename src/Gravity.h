@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace Gravity
+{
+
+// Structure-of-arrays copy of the bodies handed to a solver.
+struct Bodies
+{
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> mass;
+
+    [[nodiscard]] std::size_t size() const { return x.size(); }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        mass.clear();
+    }
+
+    void push(double pos_x, double pos_y, double body_mass)
+    {
+        x.push_back(pos_x);
+        y.push_back(pos_y);
+        mass.push_back(body_mass);
+    }
+};
+
+struct Accelerations
+{
+    std::vector<double> x;
+    std::vector<double> y;
+
+    [[nodiscard]] std::size_t size() const { return x.size(); }
+
+    void reset(std::size_t count)
+    {
+        x.assign(count, 0.0);
+        y.assign(count, 0.0);
+    }
+};
+
+struct Params
+{
+    double gravity{1.0};
+    // Plummer softening length; 0 gives the exact Newtonian force
+    double softening{0.0};
+};
+
+// Reference O(N^2) summation: acc_i = G * sum_j m_j * (r_j - r_i) / (|r_j - r_i|^2 + eps^2)^1.5
+inline void computeDirect(const Bodies &bodies, const Params &params, Accelerations &acc)
+{
+    const std::size_t count = bodies.size();
+    const double eps2 = params.softening * params.softening;
+    acc.reset(count);
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        double acc_x = 0.0;
+        double acc_y = 0.0;
+        for (std::size_t j = 0; j < count; ++j)
+        {
+            if (i == j)
+            {
+                continue;
+            }
+            const double dx = bodies.x[j] - bodies.x[i];
+            const double dy = bodies.y[j] - bodies.y[i];
+            const double dist2 = dx * dx + dy * dy + eps2;
+            const double inv_dist = 1.0 / std::sqrt(dist2);
+            const double factor = bodies.mass[j] * inv_dist * inv_dist * inv_dist;
+            acc_x += dx * factor;
+            acc_y += dy * factor;
+        }
+        acc.x[i] = acc_x * params.gravity;
+        acc.y[i] = acc_y * params.gravity;
+    }
+}
+
+// sqrt(sum |approx - reference|^2 / sum |reference|^2); used to check approximate solvers
+// against computeDirect. Unlike a per-body maximum it is not dominated by the few bodies whose
+// net force nearly cancels out.
+inline double relativeError(const Accelerations &reference, const Accelerations &approx)
+{
+    double error2 = 0.0;
+    double norm2 = 0.0;
+    for (std::size_t i = 0; i < reference.size(); ++i)
+    {
+        const double diff_x = approx.x[i] - reference.x[i];
+        const double diff_y = approx.y[i] - reference.y[i];
+        error2 += diff_x * diff_x + diff_y * diff_y;
+        norm2 += reference.x[i] * reference.x[i] + reference.y[i] * reference.y[i];
+    }
+    return norm2 > 0.0 ? std::sqrt(error2 / norm2) : 0.0;
+}
+
+} // namespace Gravity
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Gravity.h"
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace Gravity
+{
+
+enum class Integrator
+{
+    // v += a(x) dt; x += v dt. First order, one force evaluation per step.
+    SemiImplicitEuler,
+    // Kick-drift-kick leapfrog (velocity Verlet). Second order, one force evaluation per step
+    // once the accelerations of the previous step are reused.
+    Leapfrog,
+    // Yoshida's triple-jump composition of three leapfrog steps. Fourth order, three force
+    // evaluations per step.
+    Yoshida4,
+};
+
+inline const char *toString(Integrator integrator)
+{
+    switch (integrator)
+    {
+    case Integrator::SemiImplicitEuler: return "semi-implicit Euler";
+    case Integrator::Leapfrog: return "leapfrog";
+    case Integrator::Yoshida4: return "Yoshida 4";
+    }
+    return "";
+}
+
+struct Velocities
+{
+    std::vector<double> x;
+    std::vector<double> y;
+
+    [[nodiscard]] std::size_t size() const { return x.size(); }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+    }
+
+    void push(double vel_x, double vel_y)
+    {
+        x.push_back(vel_x);
+        y.push_back(vel_y);
+    }
+};
+
+// Kinetic plus potential energy with the Plummer-softened potential; O(N^2), meant for
+// measuring the drift of an integration.
+inline double totalEnergy(const Bodies &bodies, const Velocities &vel, const Params &params)
+{
+    const std::size_t count = bodies.size();
+    const double eps2 = params.softening * params.softening;
+    double kinetic = 0.0;
+    double potential = 0.0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        kinetic += 0.5 * bodies.mass[i] * (vel.x[i] * vel.x[i] + vel.y[i] * vel.y[i]);
+        for (std::size_t j = i + 1; j < count; ++j)
+        {
+            const double dx = bodies.x[j] - bodies.x[i];
+            const double dy = bodies.y[j] - bodies.y[i];
+            const double dist2 = dx * dx + dy * dy + eps2;
+            if (dist2 > 0.0)
+            {
+                potential -= bodies.mass[i] * bodies.mass[j] / std::sqrt(dist2);
+            }
+        }
+    }
+    return kinetic + potential * params.gravity;
+}
+
+// Advances positions (bodies.x/y) and velocities by dt.
+// compute(acc) must fill acc with the accelerations at the current positions of bodies.
+// acc_valid tells whether acc already holds the accelerations at the current positions; the
+// leapfrog-based schemes reuse them for their first kick and leave them valid for the next
+// step, which saves one force evaluation per step.
+template<class ForceFunc>
+void integrate(Integrator integrator, Bodies &bodies, Velocities &vel, Accelerations &acc,
+    bool &acc_valid, double dt, ForceFunc &&compute)
+{
+    const std::size_t count = bodies.size();
+
+    const auto kick = [&](double h) {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            vel.x[i] += acc.x[i] * h;
+            vel.y[i] += acc.y[i] * h;
+        }
+    };
+    const auto drift = [&](double h) {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            bodies.x[i] += vel.x[i] * h;
+            bodies.y[i] += vel.y[i] * h;
+        }
+    };
+    const auto leapfrog = [&](double h) {
+        if (!acc_valid)
+        {
+            compute(acc);
+        }
+        kick(h * 0.5);
+        drift(h);
+        compute(acc);
+        kick(h * 0.5);
+        acc_valid = true;
+    };
+
+    switch (integrator)
+    {
+    case Integrator::SemiImplicitEuler:
+        compute(acc);
+        kick(dt);
+        drift(dt);
+        acc_valid = false;
+        break;
+    case Integrator::Leapfrog: leapfrog(dt); break;
+    case Integrator::Yoshida4:
+    {
+        const double cbrt2 = std::cbrt(2.0);
+        const double w1 = 1.0 / (2.0 - cbrt2);
+        const double w0 = -cbrt2 / (2.0 - cbrt2);
+        leapfrog(w1 * dt);
+        leapfrog(w0 * dt);
+        leapfrog(w1 * dt);
+        break;
+    }
+    }
+}
+
+} // namespace Gravity
@@ -0,0 +1,420 @@
+#pragma once
+
+#include "Parallel.h"
+
+#include <SFML/Graphics/Rect.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Render
+{
+
+// Culling and level of detail for large sets of moving discs.
+// The discs are binned into a uniform grid over their bounds once per simulation step. Frames
+// draw them anywhere between their previous and current positions without binning again, as
+// the view is widened by the longest move. Each frame groups the cells into blocks a few
+// pixels wide at the current zoom (or coarser, when the cells are), and only the blocks that
+// overlap the view produce geometry, so the work of a frame follows what is on screen rather
+// than the number of discs. Discs below a pixel become points, and a block of a few pixels
+// holding many of them is drawn as one impostor disc at their center of mass instead.
+class LodGrid
+{
+public:
+    // edge of a block on screen
+    static constexpr float CELL_PIXELS = 8.0f;
+    // diameter below which a disc is drawn as a point
+    static constexpr float POINT_PIXELS = 1.0f;
+    // sub-pixel discs in one block from which they merge into an impostor
+    static constexpr std::uint32_t IMPOSTOR_MIN_COUNT = 8;
+    // discs at which an impostor is fully opaque
+    static constexpr std::uint32_t IMPOSTOR_FULL_COUNT = 64;
+    static constexpr std::size_t MAX_CELLS_PER_AXIS = 512;
+    // cells per disc, bounding the grid of small sets
+    static constexpr std::size_t MAX_CELLS_PER_DISC = 4;
+    // discs per task of the binning passes
+    static constexpr std::size_t MIN_BIN_GRAIN = 4096;
+
+    // Discs moving from (previous_x, previous_y) to (x, y) over one step; negative radii are
+    // skipped.
+    struct Discs
+    {
+        const float *x{nullptr};
+        const float *y{nullptr};
+        const float *previous_x{nullptr};
+        const float *previous_y{nullptr};
+        const float *radius{nullptr};
+        std::size_t count{0};
+    };
+
+    struct Stats
+    {
+        std::size_t visible_blocks{0};
+        // discs and impostors
+        std::size_t quads{0};
+        std::size_t points{0};
+    };
+
+    // Bins discs by their current positions, counting and then filling the cells in parallel.
+    // The arrays must stay unchanged until the next call.
+    void bin(const Discs &discs)
+    {
+        discs_ = discs;
+        const std::size_t count = discs.count;
+        const std::size_t tasks = std::clamp<std::size_t>(
+            count / MIN_BIN_GRAIN, 1, Parallel::getThreadCount());
+        const std::size_t grain = (count + tasks - 1) / tasks;
+        task_bounds_.assign(tasks, Bounds{});
+        Parallel::run(tasks, [&](std::size_t task, std::size_t) {
+            Bounds &bounds = task_bounds_[task];
+            const std::size_t end = std::min(count, (task + 1) * grain);
+            for (std::size_t i = task * grain; i < end; ++i)
+            {
+                if (discs.radius[i] >= 0.0f)
+                {
+                    bounds.add(discs, i);
+                }
+            }
+        });
+        bounds_ = Bounds{};
+        for (const Bounds &bounds : task_bounds_)
+        {
+            bounds_.merge(bounds);
+        }
+        columns_ = 0;
+        rows_ = 0;
+        cell_starts_.assign(1, 0);
+        if (bounds_.isEmpty())
+        {
+            return;
+        }
+
+        const float width = bounds_.max_x - bounds_.min_x;
+        const float height = bounds_.max_y - bounds_.min_y;
+        cell_size_ = std::max(std::max(width, height) / static_cast<float>(MAX_CELLS_PER_AXIS - 1),
+            1e-6f);
+        const auto cells_for = [&](float extent) {
+            return static_cast<std::size_t>(extent / cell_size_) + 1;
+        };
+        while (cells_for(width) * cells_for(height) > MAX_CELLS_PER_DISC * count + 64)
+        {
+            cell_size_ *= 2.0f;
+        }
+        columns_ = cells_for(width);
+        rows_ = cells_for(height);
+        const std::size_t cells = columns_ * rows_;
+
+        // every task counts its discs per cell; the counts then become the offsets at which
+        // the task writes into each cell, so the fill needs no synchronization
+        disc_cells_.resize(count);
+        task_counts_.assign(tasks * cells, 0);
+        Parallel::run(tasks, [&](std::size_t task, std::size_t) {
+            std::uint32_t *counts = task_counts_.data() + task * cells;
+            const std::size_t end = std::min(count, (task + 1) * grain);
+            for (std::size_t i = task * grain; i < end; ++i)
+            {
+                disc_cells_[i] = discs.radius[i] < 0.0f ? NO_CELL : cell_of(discs.x[i], discs.y[i]);
+                if (disc_cells_[i] != NO_CELL)
+                {
+                    counts[disc_cells_[i]]++;
+                }
+            }
+        });
+        cell_starts_.resize(cells + 1);
+        Parallel::forRange(cells, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t c = begin; c < end; ++c)
+            {
+                std::size_t total = 0;
+                for (std::size_t task = 0; task < tasks; ++task)
+                {
+                    std::uint32_t &offset = task_counts_[task * cells + c];
+                    const std::uint32_t found = offset;
+                    offset = static_cast<std::uint32_t>(total);
+                    total += found;
+                }
+                cell_starts_[c + 1] = total;
+            }
+        });
+        for (std::size_t c = 0; c < cells; ++c)
+        {
+            cell_starts_[c + 1] += cell_starts_[c];
+        }
+        cell_discs_.resize(cell_starts_.back());
+        Parallel::run(tasks, [&](std::size_t task, std::size_t) {
+            std::uint32_t *offsets = task_counts_.data() + task * cells;
+            const std::size_t end = std::min(count, (task + 1) * grain);
+            for (std::size_t i = task * grain; i < end; ++i)
+            {
+                const std::uint32_t cell = disc_cells_[i];
+                if (cell != NO_CELL)
+                {
+                    cell_discs_[cell_starts_[cell] + offsets[cell]++] =
+                        static_cast<std::uint32_t>(i);
+                }
+            }
+        });
+    }
+
+    // Appends the discs of the last bin() that are visible alpha of the way from their previous
+    // to their current positions to quads, four vertices each with texture coordinates spanning
+    // texture_size, and to points. pixel_size is the world length of one pixel.
+    void build(float alpha, const sf::FloatRect &visible, float pixel_size, float texture_size,
+        sf::Color color, std::vector<sf::Vertex> &quads, std::vector<sf::Vertex> &points) const
+    {
+        stats_ = Stats{};
+        if (!find_visible_blocks(visible, pixel_size))
+        {
+            return;
+        }
+
+        // two passes over the visible rows of blocks: count, then fill
+        const std::size_t rows = row_end_ - row_begin_;
+        row_quads_.assign(rows + 1, 0);
+        row_points_.assign(rows + 1, 0);
+        const float point_radius = 0.5f * POINT_PIXELS * pixel_size;
+        // impostors only stand for clusters that are small on screen
+        const bool impostors = span_ * cell_size_ <= 1.01f * CELL_PIXELS * pixel_size;
+        Parallel::forEach(
+            rows,
+            [&](std::size_t r) {
+                for (std::size_t c = column_begin_; c < column_end_; ++c)
+                {
+                    const Block block = classify(r + row_begin_, c, point_radius, impostors);
+                    row_quads_[r + 1] += 4 * (block.discs + (block.impostor ? 1 : 0));
+                    row_points_[r + 1] += block.points;
+                }
+            },
+            1);
+        for (std::size_t r = 0; r < rows; ++r)
+        {
+            row_quads_[r + 1] += row_quads_[r];
+            row_points_[r + 1] += row_points_[r];
+        }
+        const std::size_t quad_base = quads.size();
+        const std::size_t point_base = points.size();
+        quads.resize(quad_base + row_quads_[rows]);
+        points.resize(point_base + row_points_[rows]);
+
+        Parallel::forEach(
+            rows,
+            [&](std::size_t r) {
+                sf::Vertex *quad = quads.data() + quad_base + row_quads_[r];
+                sf::Vertex *point = points.data() + point_base + row_points_[r];
+                for (std::size_t c = column_begin_; c < column_end_; ++c)
+                {
+                    const Block block = classify(r + row_begin_, c, point_radius, impostors);
+                    double mass = 0.0;
+                    double mass_x = 0.0;
+                    double mass_y = 0.0;
+                    for_each_in_block(r + row_begin_, c, [&](std::uint32_t i) {
+                        const float radius = discs_.radius[i];
+                        const float x = discs_.previous_x[i]
+                            + alpha * (discs_.x[i] - discs_.previous_x[i]);
+                        const float y = discs_.previous_y[i]
+                            + alpha * (discs_.y[i] - discs_.previous_y[i]);
+                        if (radius >= point_radius)
+                        {
+                            write_quad(quad, x, y, radius, texture_size, color);
+                            quad += 4;
+                        }
+                        else if (block.impostor)
+                        {
+                            const double m = std::max(radius * radius, 1e-12f);
+                            mass += m;
+                            mass_x += m * x;
+                            mass_y += m * y;
+                        }
+                        else
+                        {
+                            *point++ = sf::Vertex({x, y}, color);
+                        }
+                    });
+                    if (block.impostor)
+                    {
+                        const float opacity = std::min(1.0f,
+                            static_cast<float>(block.sub_pixel) / IMPOSTOR_FULL_COUNT);
+                        sf::Color faded = color;
+                        faded.a = static_cast<sf::Uint8>(color.a * std::max(opacity, 0.25f));
+                        const auto size = static_cast<float>(std::sqrt(mass));
+                        write_quad(quad, static_cast<float>(mass_x / mass),
+                            static_cast<float>(mass_y / mass),
+                            std::max(size, 0.25f * span_ * cell_size_), texture_size, faded);
+                        quad += 4;
+                    }
+                }
+            },
+            1);
+
+        stats_.visible_blocks = rows * (column_end_ - column_begin_);
+        stats_.quads = row_quads_[rows] / 4;
+        stats_.points = row_points_[rows];
+    }
+
+    [[nodiscard]] const Stats &getStats() const { return stats_; }
+
+private:
+    struct Block
+    {
+        std::uint32_t discs{0};
+        std::uint32_t points{0};
+        std::uint32_t sub_pixel{0};
+        bool impostor{false};
+    };
+
+    // Bounds of the current positions, with the largest radius and the longest move along
+    // either axis over the step.
+    struct Bounds
+    {
+        float min_x{std::numeric_limits<float>::infinity()};
+        float max_x{-std::numeric_limits<float>::infinity()};
+        float min_y{std::numeric_limits<float>::infinity()};
+        float max_y{-std::numeric_limits<float>::infinity()};
+        float max_radius{0.0f};
+        float max_move{0.0f};
+
+        [[nodiscard]] bool isEmpty() const { return min_x > max_x; }
+
+        void add(const Discs &discs, std::size_t i)
+        {
+            min_x = std::min(min_x, discs.x[i]);
+            max_x = std::max(max_x, discs.x[i]);
+            min_y = std::min(min_y, discs.y[i]);
+            max_y = std::max(max_y, discs.y[i]);
+            max_radius = std::max(max_radius, discs.radius[i]);
+            max_move = std::max({max_move, std::abs(discs.x[i] - discs.previous_x[i]),
+                std::abs(discs.y[i] - discs.previous_y[i])});
+        }
+
+        void merge(const Bounds &other)
+        {
+            min_x = std::min(min_x, other.min_x);
+            max_x = std::max(max_x, other.max_x);
+            min_y = std::min(min_y, other.min_y);
+            max_y = std::max(max_y, other.max_y);
+            max_radius = std::max(max_radius, other.max_radius);
+            max_move = std::max(max_move, other.max_move);
+        }
+    };
+
+    [[nodiscard]] std::uint32_t cell_of(float x, float y) const
+    {
+        const auto column = static_cast<std::size_t>((x - bounds_.min_x) / cell_size_);
+        const auto row = static_cast<std::size_t>((y - bounds_.min_y) / cell_size_);
+        return static_cast<std::uint32_t>(
+            std::min(row, rows_ - 1) * columns_ + std::min(column, columns_ - 1));
+    }
+
+    // Picks the blocks for pixel_size and finds those overlapping the view; false if none do.
+    bool find_visible_blocks(const sf::FloatRect &visible, float pixel_size) const
+    {
+        if (columns_ == 0)
+        {
+            return false;
+        }
+        span_ = std::clamp<std::size_t>(
+            static_cast<std::size_t>(CELL_PIXELS * pixel_size / cell_size_), 1,
+            std::max(columns_, rows_));
+        const std::size_t block_columns = (columns_ + span_ - 1) / span_;
+        const std::size_t block_rows = (rows_ + span_ - 1) / span_;
+
+        // discs are binned by their current centers, so the view is widened by the largest
+        // radius and the longest move
+        const float reach = bounds_.max_radius + bounds_.max_move;
+        const float block_size = span_ * cell_size_;
+        const auto block_of = [&](float value, float origin, std::size_t blocks) {
+            const float index = std::floor((value - origin) / block_size);
+            return static_cast<std::size_t>(
+                std::clamp(index, 0.0f, static_cast<float>(blocks)));
+        };
+        column_begin_ = block_of(visible.left - reach, bounds_.min_x, block_columns);
+        column_end_ =
+            block_of(visible.left + visible.width + reach, bounds_.min_x, block_columns - 1) + 1;
+        row_begin_ = block_of(visible.top - reach, bounds_.min_y, block_rows);
+        row_end_ =
+            block_of(visible.top + visible.height + reach, bounds_.min_y, block_rows - 1) + 1;
+        return visible.left + visible.width + reach >= bounds_.min_x
+            && visible.top + visible.height + reach >= bounds_.min_y
+            && column_begin_ < block_columns && row_begin_ < block_rows;
+    }
+
+    // Calls func(i) for every disc binned into the block at (row, column). Each row of cells
+    // of a block is one contiguous run of the sorted discs.
+    template<class F>
+    void for_each_in_block(std::size_t row, std::size_t column, F &&func) const
+    {
+        const std::size_t row_end = std::min(rows_, (row + 1) * span_);
+        const std::size_t column_end = std::min(columns_, (column + 1) * span_);
+        for (std::size_t r = row * span_; r < row_end; ++r)
+        {
+            const std::size_t first = cell_starts_[r * columns_ + column * span_];
+            const std::size_t last = cell_starts_[r * columns_ + column_end];
+            for (std::size_t k = first; k < last; ++k)
+            {
+                func(cell_discs_[k]);
+            }
+        }
+    }
+
+    [[nodiscard]] Block classify(std::size_t row, std::size_t column, float point_radius,
+        bool impostors) const
+    {
+        Block block;
+        for_each_in_block(row, column, [&](std::uint32_t i) {
+            if (discs_.radius[i] >= point_radius)
+            {
+                block.discs++;
+            }
+            else
+            {
+                block.sub_pixel++;
+            }
+        });
+        block.impostor = impostors && block.sub_pixel >= IMPOSTOR_MIN_COUNT;
+        block.points = block.impostor ? 0 : block.sub_pixel;
+        return block;
+    }
+
+    static void write_quad(sf::Vertex *quad, float x, float y, float radius, float texture_size,
+        sf::Color color)
+    {
+        quad[0] = sf::Vertex({x - radius, y - radius}, color, {0.0f, 0.0f});
+        quad[1] = sf::Vertex({x + radius, y - radius}, color, {texture_size, 0.0f});
+        quad[2] = sf::Vertex({x + radius, y + radius}, color, {texture_size, texture_size});
+        quad[3] = sf::Vertex({x - radius, y + radius}, color, {0.0f, texture_size});
+    }
+
+private:
+    static constexpr std::uint32_t NO_CELL = ~std::uint32_t{0};
+
+    Discs discs_;
+    Bounds bounds_;
+    // cells of cell_size_ from the low corner of bounds_
+    float cell_size_{1.0f};
+    std::size_t columns_{0};
+    std::size_t rows_{0};
+
+    std::vector<Bounds> task_bounds_;
+    std::vector<std::uint32_t> disc_cells_;
+    // discs of every task per cell, then where the task writes into the cell
+    std::vector<std::uint32_t> task_counts_;
+    std::vector<std::size_t> cell_starts_;
+    std::vector<std::uint32_t> cell_discs_;
+
+    // cells per block edge and the visible blocks of the current frame:
+    // [row_begin_, row_end_) x [column_begin_, column_end_)
+    mutable std::size_t span_{1};
+    mutable std::size_t row_begin_{0};
+    mutable std::size_t row_end_{0};
+    mutable std::size_t column_begin_{0};
+    mutable std::size_t column_end_{0};
+    // quad vertices and points of the visible rows, then their prefix sums
+    mutable std::vector<std::size_t> row_quads_;
+    mutable std::vector<std::size_t> row_points_;
+    mutable Stats stats_;
+};
+
+} // namespace Render
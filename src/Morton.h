@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Gravity
+{
+
+// Interleaves the low 16 bits of value with zeros.
+inline std::uint32_t spreadMortonBits(std::uint32_t value)
+{
+    value &= 0x0000ffff;
+    value = (value | (value << 8)) & 0x00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+// Sorts count points along a Z-curve over their bounding box. Every key holds the 32-bit
+// Morton code of a point in the high half and the point's index in the low half, so the
+// codes of the top levels of a quadtree over the box are the highest bits of the keys.
+inline void sortByMortonCode(const double *x, const double *y, std::size_t count,
+    std::vector<std::uint64_t> &keys)
+{
+    keys.resize(count);
+    if (count == 0)
+    {
+        return;
+    }
+    const auto [min_x, max_x] = std::minmax_element(x, x + count);
+    const auto [min_y, max_y] = std::minmax_element(y, y + count);
+    const double extent = std::max({*max_x - *min_x, *max_y - *min_y, 1e-12});
+    const double scale = 65535.0 / extent;
+    const double origin_x = *min_x;
+    const double origin_y = *min_y;
+
+    Parallel::forEach(count, [&](std::size_t i) {
+        const auto cell_x = static_cast<std::uint32_t>((x[i] - origin_x) * scale);
+        const auto cell_y = static_cast<std::uint32_t>((y[i] - origin_y) * scale);
+        const std::uint32_t code = spreadMortonBits(cell_x) | spreadMortonBits(cell_y) << 1;
+        keys[i] = static_cast<std::uint64_t>(code) << 32 | i;
+    });
+
+    // sorts independent blocks on every thread, then merges neighbouring blocks pairwise
+    const std::size_t blocks = std::min(Parallel::getThreadCount(), count / 4096 + 1);
+    const std::size_t block_size = (count + blocks - 1) / blocks;
+    const auto block_begin = [&](std::size_t block) {
+        return keys.begin() + std::min(count, block * block_size);
+    };
+
+    Parallel::forEach(
+        blocks, [&](std::size_t b) { std::sort(block_begin(b), block_begin(b + 1)); }, 1);
+
+    for (std::size_t width = 1; width < blocks; width *= 2)
+    {
+        const std::size_t merges = (blocks + 2 * width - 1) / (2 * width);
+        Parallel::forEach(
+            merges,
+            [&](std::size_t m) {
+                const std::size_t first = m * 2 * width;
+                std::inplace_merge(block_begin(first), block_begin(first + width),
+                    block_begin(first + 2 * width));
+            },
+            1);
+    }
+}
+
+} // namespace Gravity
@@ -0,0 +1,288 @@
+#pragma once
+
+#include "Gravity.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Pairwise
+{
+
+// A force law is a functor with
+//     double operator()(double dist2, double mass_i, double mass_j) const
+// returning s such that the force on body i from body j is s * (r_j - r_i), so positive values
+// attract, and
+//     double cutoff() const
+// returning the finite range of the law. It is only called for pairs at a nonzero distance
+// within the cutoff. Being a template parameter, it inlines into the loops below. Gravity is
+// not a law here: it stays with the specialised solvers.
+
+// 12-6 potential, cut off at range * sigma.
+struct LennardJones
+{
+    double epsilon{1.0};
+    double sigma{1.0};
+    double range{2.5};
+
+    [[nodiscard]] double cutoff() const { return range * sigma; }
+
+    double operator()(double dist2, double, double) const
+    {
+        const double s2 = sigma * sigma / dist2;
+        const double s6 = s2 * s2 * s2;
+        return -24.0 * epsilon * (2.0 * s6 * s6 - s6) / dist2;
+    }
+};
+
+// Repulsion falling linearly from strength at contact to 0 at range.
+struct SoftRepulsion
+{
+    double strength{1.0};
+    double range{1.0};
+
+    [[nodiscard]] double cutoff() const { return range; }
+
+    double operator()(double dist2, double, double) const
+    {
+        const double dist = std::sqrt(dist2);
+        return -strength * (1.0 - dist / range) / dist;
+    }
+};
+
+// Hookean spring towards rest_length between every pair closer than range.
+struct Spring
+{
+    double stiffness{1.0};
+    double rest_length{1.0};
+    double range{2.0};
+
+    [[nodiscard]] double cutoff() const { return range; }
+
+    double operator()(double dist2, double, double) const
+    {
+        const double dist = std::sqrt(dist2);
+        return stiffness * (dist - rest_length) / dist;
+    }
+};
+
+// Verlet neighbor list: for every body, the bodies within cutoff + skin when it was built.
+// It stays valid until some body has moved more than half the skin, so the cell-list build
+// is amortized over many steps. The list is full (each pair appears for both bodies), which
+// lets force passes run over rows in parallel without write conflicts.
+class NeighborList
+{
+public:
+    void setSkin(double skin)
+    {
+        assert(skin >= 0.0);
+        skin_ = skin;
+        invalidate();
+    }
+    [[nodiscard]] double getSkin() const { return skin_; }
+
+    void invalidate() { built_x_.clear(); }
+
+    // Rebuilds the list if the body count or the cutoff changed, or if a body moved more than
+    // half the skin since the last build. Returns whether it was rebuilt.
+    bool update(const Gravity::Bodies &bodies, double cutoff)
+    {
+        assert(std::isfinite(cutoff));
+        if (bodies.size() != built_x_.size() || cutoff != cutoff_ || moved_too_far(bodies))
+        {
+            cutoff_ = cutoff;
+            build(bodies);
+            build_count_++;
+            return true;
+        }
+        return false;
+    }
+
+    [[nodiscard]] std::size_t getBuildCount() const { return build_count_; }
+    [[nodiscard]] double getCutoff() const { return cutoff_; }
+
+    [[nodiscard]] const std::uint32_t *begin(std::size_t body) const
+    {
+        return neighbors_.data() + offsets_[body];
+    }
+    [[nodiscard]] const std::uint32_t *end(std::size_t body) const
+    {
+        return neighbors_.data() + offsets_[body + 1];
+    }
+
+private:
+    // grid cells allowed per body before the cells are enlarged, which bounds the memory of
+    // sparse scenes
+    static constexpr std::size_t MAX_CELLS_PER_BODY = 4;
+
+    [[nodiscard]] bool moved_too_far(const Gravity::Bodies &bodies) const
+    {
+        const double limit2 = 0.25 * skin_ * skin_;
+        std::atomic<bool> moved{false};
+        Parallel::forRange(bodies.size(), [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end && !moved.load(std::memory_order_relaxed); ++i)
+            {
+                const double dx = bodies.x[i] - built_x_[i];
+                const double dy = bodies.y[i] - built_y_[i];
+                if (dx * dx + dy * dy > limit2)
+                {
+                    moved.store(true, std::memory_order_relaxed);
+                }
+            }
+        });
+        return moved.load();
+    }
+
+    void build(const Gravity::Bodies &bodies)
+    {
+        const std::size_t count = bodies.size();
+        built_x_ = bodies.x;
+        built_y_ = bodies.y;
+        offsets_.assign(count + 1, 0);
+        neighbors_.clear();
+        if (count == 0)
+        {
+            return;
+        }
+
+        // cell list: bodies counting-sorted into square cells of at least the list radius
+        const double radius = cutoff_ + skin_;
+        const auto [min_x, max_x] = std::minmax_element(bodies.x.begin(), bodies.x.end());
+        const auto [min_y, max_y] = std::minmax_element(bodies.y.begin(), bodies.y.end());
+        double cell = std::max(radius, 1e-12);
+        const auto columns_for = [&](double extent) {
+            return static_cast<std::size_t>(extent / cell) + 1;
+        };
+        while (columns_for(*max_x - *min_x) * columns_for(*max_y - *min_y)
+            > MAX_CELLS_PER_BODY * count + 64)
+        {
+            cell *= 2.0;
+        }
+        const std::size_t columns = columns_for(*max_x - *min_x);
+        const std::size_t rows = columns_for(*max_y - *min_y);
+        const double origin_x = *min_x;
+        const double origin_y = *min_y;
+
+        body_cells_.resize(count);
+        cell_starts_.assign(columns * rows + 1, 0);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const auto column = static_cast<std::size_t>((bodies.x[i] - origin_x) / cell);
+            const auto row = static_cast<std::size_t>((bodies.y[i] - origin_y) / cell);
+            body_cells_[i] = static_cast<std::uint32_t>(
+                std::min(row, rows - 1) * columns + std::min(column, columns - 1));
+            cell_starts_[body_cells_[i] + 1]++;
+        }
+        for (std::size_t c = 0; c < columns * rows; ++c)
+        {
+            cell_starts_[c + 1] += cell_starts_[c];
+        }
+        cell_bodies_.resize(count);
+        cell_cursor_.assign(cell_starts_.begin(), cell_starts_.end() - 1);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            cell_bodies_[cell_cursor_[body_cells_[i]]++] = static_cast<std::uint32_t>(i);
+        }
+
+        // two passes over the 3x3 cell neighborhoods: count, then fill
+        const double radius2 = radius * radius;
+        const auto for_each_near = [&](std::size_t i, auto &&func) {
+            const std::size_t column = body_cells_[i] % columns;
+            const std::size_t row = body_cells_[i] / columns;
+            for (std::size_t r = row > 0 ? row - 1 : 0; r <= std::min(row + 1, rows - 1); ++r)
+            {
+                for (std::size_t c = column > 0 ? column - 1 : 0;
+                     c <= std::min(column + 1, columns - 1); ++c)
+                {
+                    const std::size_t cell_index = r * columns + c;
+                    for (std::size_t k = cell_starts_[cell_index]; k < cell_starts_[cell_index + 1];
+                         ++k)
+                    {
+                        const std::uint32_t j = cell_bodies_[k];
+                        const double dx = bodies.x[j] - bodies.x[i];
+                        const double dy = bodies.y[j] - bodies.y[i];
+                        if (j != i && dx * dx + dy * dy < radius2)
+                        {
+                            func(j);
+                        }
+                    }
+                }
+            }
+        };
+
+        Parallel::forEach(count, [&](std::size_t i) {
+            std::uint32_t found = 0;
+            for_each_near(i, [&](std::uint32_t) { found++; });
+            offsets_[i + 1] = found;
+        });
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            offsets_[i + 1] += offsets_[i];
+        }
+        neighbors_.resize(offsets_[count]);
+        Parallel::forEach(count, [&](std::size_t i) {
+            std::size_t out = offsets_[i];
+            for_each_near(i, [&](std::uint32_t j) { neighbors_[out++] = j; });
+        });
+    }
+
+private:
+    double skin_{1.0};
+    double cutoff_{0.0};
+    std::size_t build_count_{0};
+
+    // positions at the last build
+    std::vector<double> built_x_;
+    std::vector<double> built_y_;
+
+    // CSR list: the neighbors of body i are neighbors_[offsets_[i], offsets_[i + 1])
+    std::vector<std::size_t> offsets_;
+    std::vector<std::uint32_t> neighbors_;
+
+    // cell list scratch
+    std::vector<std::uint32_t> body_cells_;
+    std::vector<std::size_t> cell_starts_;
+    std::vector<std::size_t> cell_cursor_;
+    std::vector<std::uint32_t> cell_bodies_;
+};
+
+// Adds the accelerations due to a short-range law over a neighbor list that is up to date
+// for bodies (see NeighborList::update); O(N * neighbors).
+template<class Law>
+void addNeighborPairs(const Gravity::Bodies &bodies, const Law &law, const NeighborList &list,
+    Gravity::Accelerations &acc)
+{
+    const std::size_t count = bodies.size();
+    assert(acc.size() >= count);
+    assert(law.cutoff() <= list.getCutoff());
+    const double cutoff2 = law.cutoff() * law.cutoff();
+    Parallel::forEach(count, [&](std::size_t i) {
+        if (bodies.mass[i] <= 0.0)
+        {
+            return;
+        }
+        double force_x = 0.0;
+        double force_y = 0.0;
+        for (const std::uint32_t *j = list.begin(i); j != list.end(i); ++j)
+        {
+            const double dx = bodies.x[*j] - bodies.x[i];
+            const double dy = bodies.y[*j] - bodies.y[i];
+            const double dist2 = dx * dx + dy * dy;
+            if (dist2 > 0.0 && dist2 < cutoff2)
+            {
+                const double s = law(dist2, bodies.mass[i], bodies.mass[*j]);
+                force_x += s * dx;
+                force_y += s * dy;
+            }
+        }
+        acc.x[i] += force_x / bodies.mass[i];
+        acc.y[i] += force_y / bodies.mass[i];
+    });
+}
+
+} // namespace Pairwise
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Parallel
+{
+
+// Persistent worker threads executing indexed tasks with work stealing.
+// run() deals the task range out in equal contiguous slices, one per worker. A worker takes
+// tasks from the front of its own slice and, once it runs dry, steals from the back of the
+// other slices, so uneven tasks (e.g. triangular tiles) still balance out. The calling thread
+// takes part as worker 0. Fewer threads than the pool was created with can be put to work, the
+// others staying parked, so that trying out thread counts does not respawn threads.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(std::size_t thread_count)
+        : slices_(std::max<std::size_t>(thread_count, 1))
+        , active_(slices_.size())
+    {
+        for (std::size_t worker = 1; worker < slices_.size(); ++worker)
+        {
+            threads_.emplace_back([this, worker]() { worker_loop(worker); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread &thread : threads_)
+        {
+            thread.join();
+        }
+    }
+
+    // Threads that take part in run(), the calling one included.
+    [[nodiscard]] std::size_t getThreadCount() const { return active_; }
+    // Threads the pool was created with.
+    [[nodiscard]] std::size_t getCapacity() const { return slices_.size(); }
+
+    // Puts thread_count threads to work from the next run() on, clamped to [1, capacity].
+    // Must not be called while a run is in progress.
+    void setThreadCount(std::size_t thread_count)
+    {
+        active_ = std::clamp<std::size_t>(thread_count, 1, slices_.size());
+    }
+
+    // Calls func(task, worker) for every task in [0, task_count) and returns when all are done.
+    // worker is in [0, getThreadCount()) and no two tasks of the same call run concurrently
+    // with the same worker, so it can index per-thread scratch data owned by the caller.
+    // Calls made from inside a task, or while another thread owns the pool, run serially on
+    // the calling thread as worker 0 instead of waiting.
+    template<class F>
+    void run(std::size_t task_count, F &&func)
+    {
+        if (task_count == 0)
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> job_lock(job_mutex_, std::defer_lock);
+        if (active_ == 1 || task_count == 1 || current_pool() != nullptr
+            || !job_lock.try_lock())
+        {
+            for (std::size_t task = 0; task < task_count; ++task)
+            {
+                func(task, std::size_t{0});
+            }
+            return;
+        }
+
+        assert(task_count <= UINT32_MAX);
+        const std::size_t workers = active_;
+        for (std::size_t worker = 0; worker < workers; ++worker)
+        {
+            const auto begin = static_cast<std::uint32_t>(task_count * worker / workers);
+            const auto end = static_cast<std::uint32_t>(task_count * (worker + 1) / workers);
+            slices_[worker].range.store(pack(begin, end), std::memory_order_relaxed);
+        }
+
+        job_context_ = &func;
+        job_invoke_ = [](void *context, std::size_t task, std::size_t worker) {
+            (*static_cast<std::remove_reference_t<F> *>(context))(task, worker);
+        };
+        busy_workers_.store(workers - 1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_workers_ = workers;
+            generation_++;
+        }
+        wake_.notify_all();
+
+        execute(0, workers);
+
+        // workers may still be finishing stolen tasks
+        while (busy_workers_.load(std::memory_order_acquire) != 0)
+        {
+            std::this_thread::yield();
+        }
+        job_context_ = nullptr;
+    }
+
+private:
+    // [begin, end) of one worker's slice packed into a single word, so that the owner and the
+    // thieves can claim tasks with one compare-and-swap
+    struct alignas(64) Slice
+    {
+        std::atomic<std::uint64_t> range{0};
+    };
+
+    static std::uint64_t pack(std::uint32_t begin, std::uint32_t end)
+    {
+        return static_cast<std::uint64_t>(begin) << 32 | end;
+    }
+
+    static ThreadPool *&current_pool()
+    {
+        thread_local ThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    bool pop_front(std::size_t worker, std::size_t &task)
+    {
+        std::atomic<std::uint64_t> &range = slices_[worker].range;
+        std::uint64_t value = range.load(std::memory_order_relaxed);
+        while (true)
+        {
+            const auto begin = static_cast<std::uint32_t>(value >> 32);
+            const auto end = static_cast<std::uint32_t>(value);
+            if (begin >= end)
+            {
+                return false;
+            }
+            if (range.compare_exchange_weak(value, pack(begin + 1, end), std::memory_order_acq_rel))
+            {
+                task = begin;
+                return true;
+            }
+        }
+    }
+
+    bool steal_back(std::size_t victim, std::size_t &task)
+    {
+        std::atomic<std::uint64_t> &range = slices_[victim].range;
+        std::uint64_t value = range.load(std::memory_order_relaxed);
+        while (true)
+        {
+            const auto begin = static_cast<std::uint32_t>(value >> 32);
+            const auto end = static_cast<std::uint32_t>(value);
+            if (begin >= end)
+            {
+                return false;
+            }
+            if (range.compare_exchange_weak(value, pack(begin, end - 1), std::memory_order_acq_rel))
+            {
+                task = end - 1;
+                return true;
+            }
+        }
+    }
+
+    void execute(std::size_t worker, std::size_t workers)
+    {
+        current_pool() = this;
+        std::size_t task = 0;
+        while (pop_front(worker, task))
+        {
+            job_invoke_(job_context_, task, worker);
+        }
+        for (std::size_t offset = 1; offset < workers; ++offset)
+        {
+            const std::size_t victim = (worker + offset) % workers;
+            while (steal_back(victim, task))
+            {
+                job_invoke_(job_context_, task, worker);
+            }
+        }
+        current_pool() = nullptr;
+    }
+
+    void worker_loop(std::size_t worker)
+    {
+        std::uint64_t seen_generation = 0;
+        while (true)
+        {
+            std::size_t workers = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&]() { return stopping_ || generation_ != seen_generation; });
+                if (stopping_)
+                {
+                    return;
+                }
+                seen_generation = generation_;
+                workers = job_workers_;
+            }
+            // parked workers sit the job out
+            if (worker >= workers)
+            {
+                continue;
+            }
+            execute(worker, workers);
+            busy_workers_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+private:
+    std::vector<Slice> slices_;
+    std::vector<std::thread> threads_;
+    // workers [0, active_) take part in run(); only changed between runs
+    std::size_t active_;
+
+    // held by the thread whose job is running
+    std::mutex job_mutex_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::uint64_t generation_{0};
+    // workers taking part in the job of generation_
+    std::size_t job_workers_{0};
+    bool stopping_{false};
+
+    void *job_context_{nullptr};
+    void (*job_invoke_)(void *context, std::size_t task, std::size_t worker){nullptr};
+    std::atomic<std::size_t> busy_workers_{0};
+};
+
+
+inline std::unique_ptr<ThreadPool> &poolInstance()
+{
+    static std::unique_ptr<ThreadPool> pool =
+        std::make_unique<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+// Pool installed on the calling thread by a ThreadPoolScope, if any.
+inline ThreadPool *&threadPoolOverride()
+{
+    thread_local ThreadPool *pool = nullptr;
+    return pool;
+}
+
+// The pool parallel loops of the calling thread run on.
+inline ThreadPool &getPool()
+{
+    ThreadPool *own = threadPoolOverride();
+    return own != nullptr ? *own : *poolInstance();
+}
+
+inline std::size_t getThreadCount()
+{
+    return getPool().getThreadCount();
+}
+
+// Sets the threads of the shared pool; 0 means one per hardware thread. Up to the hardware
+// thread count this parks or wakes threads of the pool, only larger counts replace it.
+// Must not be called while a parallel loop is running.
+inline void setThreadCount(std::size_t thread_count)
+{
+    if (thread_count == 0)
+    {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (thread_count > poolInstance()->getCapacity())
+    {
+        poolInstance() = std::make_unique<ThreadPool>(thread_count);
+    }
+    poolInstance()->setThreadCount(thread_count);
+}
+
+// Runs the parallel loops of the constructing thread on pool instead of the shared one while
+// alive. A second long-lived thread uses this so that it neither competes with the owner of
+// the shared pool nor holds on to it while setThreadCount replaces it.
+class ThreadPoolScope
+{
+public:
+    explicit ThreadPoolScope(ThreadPool &pool)
+        : previous_(threadPoolOverride())
+    {
+        threadPoolOverride() = &pool;
+    }
+
+    ThreadPoolScope(const ThreadPoolScope &) = delete;
+    ThreadPoolScope &operator=(const ThreadPoolScope &) = delete;
+
+    ~ThreadPoolScope() { threadPoolOverride() = previous_; }
+
+private:
+    ThreadPool *previous_;
+};
+
+// Calls func(task, worker) for every task in [0, task_count) on the pool of the calling thread.
+template<class F>
+void run(std::size_t task_count, F &&func)
+{
+    getPool().run(task_count, std::forward<F>(func));
+}
+
+// Cuts [0, count) into ranges of at least min_grain elements, a few per thread so stealing
+// can even out the load, and calls func(begin, end) for each of them.
+template<class F>
+void forRange(std::size_t count, F &&func, std::size_t min_grain = 256)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    const std::size_t grain =
+        std::max(std::max<std::size_t>(min_grain, 1), count / (getThreadCount() * 8));
+    const std::size_t tasks = (count + grain - 1) / grain;
+    run(tasks, [&func, grain, count](std::size_t task, std::size_t) {
+        func(task * grain, std::min(count, (task + 1) * grain));
+    });
+}
+
+// Calls func(i) for every i in [0, count).
+template<class F>
+void forEach(std::size_t count, F &&func, std::size_t min_grain = 256)
+{
+    forRange(
+        count,
+        [&func](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                func(i);
+            }
+        },
+        min_grain);
+}
+
+} // namespace Parallel
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "FFT.h"
+#include "Gravity.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace Gravity
+{
+
+// Particle-mesh gravity for large, smooth distributions.
+// Masses are deposited onto a square grid over the bodies with cloud-in-cell weights, convolved
+// with the 1/r^2 force kernel by FFT on a grid padded to twice the size (so the system is
+// isolated rather than periodic), and the field is interpolated back with the same weights.
+// Cost is O(N + G^2 log G) for a G x G grid; forces are smoothed below about two cells.
+class ParticleMeshSolver
+{
+public:
+    static constexpr std::size_t DEFAULT_GRID_SIZE = 256;
+
+    // Cells per side; must be a power of two.
+    void setGridSize(std::size_t size)
+    {
+        assert(size >= 4 && (size & (size - 1)) == 0);
+        grid_size_ = size;
+    }
+    [[nodiscard]] std::size_t getGridSize() const { return grid_size_; }
+
+    void computeAccelerations(const Bodies &bodies, const Params &params, Accelerations &acc)
+    {
+        computeAccelerationsAt(bodies, bodies.x.data(), bodies.y.data(), bodies.size(), params,
+            acc);
+    }
+
+    // Accelerations at target_count arbitrary points due to all sources. The grid is laid over
+    // the sources and the targets together.
+    void computeAccelerationsAt(const Bodies &sources, const double *target_x,
+        const double *target_y, std::size_t target_count, const Params &params,
+        Accelerations &acc)
+    {
+        acc.reset(target_count);
+        if (target_count == 0 || sources.size() == 0)
+        {
+            return;
+        }
+
+        fit_grid(sources, target_x, target_y, target_count);
+        update_kernel(params.softening / cell_size_);
+        deposit(sources);
+        fft_.transform2d(field_, false);
+        for (std::size_t i = 0; i < field_.size(); ++i)
+        {
+            field_[i] *= kernel_[i];
+        }
+        fft_.transform2d(field_, true);
+
+        // the inverse FFT is unnormalised, and the kernel is in cell units
+        const double padded = static_cast<double>(2 * grid_size_);
+        const double scale = params.gravity / (padded * padded * cell_size_ * cell_size_);
+        Parallel::forEach(target_count, [&](std::size_t i) {
+            const std::complex<double> value = interpolate(target_x[i], target_y[i]);
+            acc.x[i] = value.real() * scale;
+            acc.y[i] = value.imag() * scale;
+        });
+    }
+
+private:
+    using Complex = std::complex<double>;
+
+    struct Weights
+    {
+        std::size_t cell_x;
+        std::size_t cell_y;
+        double frac_x;
+        double frac_y;
+    };
+
+    void fit_grid(const Bodies &sources, const double *target_x, const double *target_y,
+        std::size_t target_count)
+    {
+        const auto [min_x, max_x] = std::minmax_element(sources.x.begin(), sources.x.end());
+        const auto [min_y, max_y] = std::minmax_element(sources.y.begin(), sources.y.end());
+        double lo_x = *min_x;
+        double hi_x = *max_x;
+        double lo_y = *min_y;
+        double hi_y = *max_y;
+        for (std::size_t i = 0; i < target_count; ++i)
+        {
+            lo_x = std::min(lo_x, target_x[i]);
+            hi_x = std::max(hi_x, target_x[i]);
+            lo_y = std::min(lo_y, target_y[i]);
+            hi_y = std::max(hi_y, target_y[i]);
+        }
+
+        // the last cell is left free so that cell + 1 of every body stays on the grid
+        const double extent = std::max({hi_x - lo_x, hi_y - lo_y, 1e-12});
+        cell_size_ = extent / static_cast<double>(grid_size_ - 2);
+        origin_x_ = lo_x;
+        origin_y_ = lo_y;
+    }
+
+    [[nodiscard]] Weights weights_at(double x, double y) const
+    {
+        const double limit = static_cast<double>(grid_size_ - 2);
+        const double u = std::clamp((x - origin_x_) / cell_size_, 0.0, limit);
+        const double v = std::clamp((y - origin_y_) / cell_size_, 0.0, limit);
+        const auto cell_x = static_cast<std::size_t>(u);
+        const auto cell_y = static_cast<std::size_t>(v);
+        return Weights{cell_x, cell_y, u - cell_x, v - cell_y};
+    }
+
+    // Fourier transform of the force kernel -d / (|d|^2 + eps^2)^1.5 on the padded grid, with
+    // the x component in the real and the y component in the imaginary part, so that a single
+    // inverse transform yields both force components.
+    void update_kernel(double softening_cells)
+    {
+        const std::size_t padded = 2 * grid_size_;
+        if (kernel_.size() == padded * padded && kernel_softening_ == softening_cells)
+        {
+            return;
+        }
+        fft_.resize(padded);
+        kernel_softening_ = softening_cells;
+        kernel_.assign(padded * padded, Complex{});
+        field_.resize(padded * padded);
+
+        const double eps2 = softening_cells * softening_cells;
+        const auto offset = [&](std::size_t index) {
+            return index < grid_size_ ? static_cast<double>(index)
+                                      : static_cast<double>(index) - static_cast<double>(padded);
+        };
+        Parallel::forEach(
+            padded,
+            [&](std::size_t row) {
+                const double dy = offset(row);
+                for (std::size_t column = 0; column < padded; ++column)
+                {
+                    const double dx = offset(column);
+                    const double dist2 = dx * dx + dy * dy + eps2;
+                    // no self-force, and the offset of -grid_size never occurs
+                    if (dist2 == 0.0 || row == grid_size_ || column == grid_size_)
+                    {
+                        continue;
+                    }
+                    const double inv_dist = 1.0 / std::sqrt(dist2);
+                    const double factor = -inv_dist * inv_dist * inv_dist;
+                    kernel_[row * padded + column] = Complex{dx * factor, dy * factor};
+                }
+            },
+            4);
+        fft_.transform2d(kernel_, false);
+    }
+
+    // Cloud-in-cell deposit into per-worker grids, which are then summed into the padded
+    // field.
+    void deposit(const Bodies &sources)
+    {
+        const std::size_t cells = grid_size_ * grid_size_;
+        const std::size_t count = sources.size();
+        const std::size_t workers = Parallel::getThreadCount();
+        worker_mass_.resize(workers);
+        for (std::vector<double> &mass : worker_mass_)
+        {
+            mass.assign(cells, 0.0);
+        }
+
+        const std::size_t grain = std::max<std::size_t>(1024, count / (workers * 8));
+        const std::size_t tasks = (count + grain - 1) / grain;
+        Parallel::run(tasks, [&](std::size_t task, std::size_t worker) {
+            std::vector<double> &mass = worker_mass_[worker];
+            const std::size_t end = std::min(count, (task + 1) * grain);
+            for (std::size_t i = task * grain; i < end; ++i)
+            {
+                const Weights w = weights_at(sources.x[i], sources.y[i]);
+                const double m = sources.mass[i];
+                const std::size_t cell = w.cell_y * grid_size_ + w.cell_x;
+                mass[cell] += m * (1.0 - w.frac_x) * (1.0 - w.frac_y);
+                mass[cell + 1] += m * w.frac_x * (1.0 - w.frac_y);
+                mass[cell + grid_size_] += m * (1.0 - w.frac_x) * w.frac_y;
+                mass[cell + grid_size_ + 1] += m * w.frac_x * w.frac_y;
+            }
+        });
+
+        const std::size_t padded = 2 * grid_size_;
+        Parallel::forEach(
+            padded,
+            [&](std::size_t row) {
+                Complex *out = field_.data() + row * padded;
+                std::fill(out, out + padded, Complex{});
+                if (row >= grid_size_)
+                {
+                    return;
+                }
+                for (const std::vector<double> &mass : worker_mass_)
+                {
+                    const double *in = mass.data() + row * grid_size_;
+                    for (std::size_t column = 0; column < grid_size_; ++column)
+                    {
+                        out[column] += in[column];
+                    }
+                }
+            },
+            4);
+    }
+
+    [[nodiscard]] Complex interpolate(double x, double y) const
+    {
+        const std::size_t padded = 2 * grid_size_;
+        const Weights w = weights_at(x, y);
+        const Complex *row = field_.data() + w.cell_y * padded + w.cell_x;
+        const Complex *next_row = row + padded;
+        return row[0] * ((1.0 - w.frac_x) * (1.0 - w.frac_y))
+            + row[1] * (w.frac_x * (1.0 - w.frac_y)) + next_row[0] * ((1.0 - w.frac_x) * w.frac_y)
+            + next_row[1] * (w.frac_x * w.frac_y);
+    }
+
+private:
+    std::size_t grid_size_{DEFAULT_GRID_SIZE};
+    double cell_size_{1.0};
+    double origin_x_{0.0};
+    double origin_y_{0.0};
+
+    Math::Fft fft_;
+    // transformed force kernel and the softening (in cells) it was built for
+    std::vector<Complex> kernel_;
+    double kernel_softening_{0.0};
+    // padded mass grid, then the force field after the convolution
+    std::vector<Complex> field_;
+    std::vector<std::vector<double>> worker_mass_;
+};
+
+} // namespace Gravity
@@ -0,0 +1,321 @@
+#pragma once
+
+#include "Gravity.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <utility>
+#include <vector>
+
+namespace Gravity
+{
+
+// Acceleration field of bodies that never move, sampled once on a square grid.
+// Lookups interpolate bilinearly between the four surrounding samples, which costs the same
+// whatever the number of static sources. Where the field is too steep to interpolate (within
+// NEAR_CELLS of a source) or outside the grid, the sources are summed exactly instead, as they
+// are when there are too few of them for a grid lookup to pay off.
+// The grid is sampled on a thread of its own, so a bake never stalls the caller; lookups sum
+// the sources exactly until update() installs the finished grid.
+class StaticField
+{
+public:
+    static constexpr std::size_t DEFAULT_RESOLUTION = 1024;
+    static constexpr double DEFAULT_MARGIN = 2000.0;
+    // cells around a static source that are evaluated exactly
+    static constexpr int NEAR_CELLS = 3;
+    // fewer sources than this are summed exactly by default
+    static constexpr std::size_t DEFAULT_MIN_BAKED_SOURCES = 8;
+
+    StaticField() = default;
+    StaticField(const StaticField &) = delete;
+    StaticField &operator=(const StaticField &) = delete;
+
+    ~StaticField() { setBakePool(nullptr); }
+
+    // Cells per side of the grid.
+    void setResolution(std::size_t resolution)
+    {
+        assert(resolution >= 2);
+        resolution_ = resolution;
+        invalidate();
+    }
+    [[nodiscard]] std::size_t getResolution() const { return resolution_; }
+
+    // Distance the grid extends beyond the bounding box of the sources.
+    void setMargin(double margin)
+    {
+        assert(margin > 0.0);
+        margin_ = margin;
+        invalidate();
+    }
+    [[nodiscard]] double getMargin() const { return margin_; }
+
+    // Fewer sources than this are always summed exactly. A heavy source sampled by many
+    // bodies can be worth a grid on its own.
+    void setMinBakedSources(std::size_t count)
+    {
+        assert(count >= 1);
+        min_baked_sources_ = count;
+        invalidate();
+    }
+    [[nodiscard]] std::size_t getMinBakedSources() const { return min_baked_sources_; }
+
+    // Pool the grid is sampled on; null samples it on the baking thread alone. Waits for a
+    // running bake, which may still use the previous pool.
+    void setBakePool(Parallel::ThreadPool *pool)
+    {
+        if (running_.valid())
+        {
+            running_.wait();
+        }
+        pool_ = pool;
+    }
+
+    void invalidate() { baked_ = false; }
+    // Whether the field holds the sources of the last bake; its grid may still be sampled.
+    [[nodiscard]] bool isBaked() const { return baked_; }
+    [[nodiscard]] bool isGridReady() const { return !grid_.field.empty(); }
+    [[nodiscard]] std::size_t getSourceCount() const { return sources_.size(); }
+
+    // Replaces the sources and starts sampling their field; O(resolution^2 * sources) on the
+    // bake pool. Lookups sum the new sources exactly right away. A bake that is still running
+    // for older sources finishes first and is thrown away.
+    void bake(const Bodies &sources, const Params &params)
+    {
+        sources_ = sources;
+        params_ = params;
+        baked_ = true;
+        grid_ = Grid{};
+        request_++;
+        if (!running_.valid())
+        {
+            start_bake();
+        }
+    }
+
+    // Installs the grid of a finished bake of the current sources, starting the bake of newer
+    // ones if it was for older sources. Returns whether lookups changed.
+    bool update()
+    {
+        if (!running_.valid()
+            || running_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            return false;
+        }
+        auto [request, grid] = running_.get();
+        if (request != request_)
+        {
+            start_bake();
+            return false;
+        }
+        grid_ = std::move(grid);
+        return !grid_.field.empty();
+    }
+
+    // Adds the field at count points to acc.
+    void addAccelerations(const double *x, const double *y, std::size_t count,
+        Accelerations &acc) const
+    {
+        assert(baked_ && acc.size() >= count);
+        if (sources_.size() == 0)
+        {
+            return;
+        }
+        Parallel::forEach(count, [&](std::size_t i) {
+            double acc_x = 0.0;
+            double acc_y = 0.0;
+            sample(x[i], y[i], acc_x, acc_y);
+            acc.x[i] += acc_x;
+            acc.y[i] += acc_y;
+        });
+    }
+
+    // Potential energy of bodies in the field, summed exactly.
+    [[nodiscard]] double potentialEnergy(const Bodies &bodies) const
+    {
+        const double eps2 = params_.softening * params_.softening;
+        double energy = 0.0;
+        for (std::size_t i = 0; i < bodies.size(); ++i)
+        {
+            for (std::size_t s = 0; s < sources_.size(); ++s)
+            {
+                const double dx = sources_.x[s] - bodies.x[i];
+                const double dy = sources_.y[s] - bodies.y[i];
+                const double dist2 = dx * dx + dy * dy + eps2;
+                if (dist2 > 0.0)
+                {
+                    energy -= bodies.mass[i] * sources_.mass[s] / std::sqrt(dist2);
+                }
+            }
+        }
+        return energy * params_.gravity;
+    }
+
+private:
+    // interpolation error dominates float rounding, and halving the grid keeps more of it in
+    // cache
+    struct Sample
+    {
+        float x;
+        float y;
+    };
+
+    struct Grid
+    {
+        std::size_t resolution{0};
+        double cell_size{1.0};
+        double origin_x{0.0};
+        double origin_y{0.0};
+        // (resolution + 1)^2 samples, row-major; empty when the sources are summed exactly
+        std::vector<Sample> field;
+        // per cell: 1 where lookups fall back to the exact sum
+        std::vector<std::uint8_t> near;
+    };
+
+    // Samples the current sources on a new thread, on the bake pool; nothing to do when they
+    // are too few for a grid.
+    void start_bake()
+    {
+        if (sources_.size() < min_baked_sources_)
+        {
+            return;
+        }
+        running_ = std::async(std::launch::async,
+            [sources = sources_, params = params_, resolution = resolution_, margin = margin_,
+                pool = pool_, request = request_]() {
+                // without a pool, a pool of one runs every loop on this thread
+                Parallel::ThreadPool serial(1);
+                const Parallel::ThreadPoolScope scope(pool != nullptr ? *pool : serial);
+                return std::make_pair(request, sample_grid(sources, params, resolution, margin));
+            });
+    }
+
+    static Grid sample_grid(const Bodies &sources, const Params &params, std::size_t resolution,
+        double margin)
+    {
+        Grid grid;
+        grid.resolution = resolution;
+        const std::size_t nodes = resolution + 1;
+        grid.field.resize(nodes * nodes);
+        grid.near.assign(resolution * resolution, 0);
+
+        const auto [min_x, max_x] = std::minmax_element(sources.x.begin(), sources.x.end());
+        const auto [min_y, max_y] = std::minmax_element(sources.y.begin(), sources.y.end());
+        const double extent = std::max(*max_x - *min_x, *max_y - *min_y) + 2.0 * margin;
+        grid.cell_size = extent / static_cast<double>(resolution);
+        grid.origin_x = (*min_x + *max_x - extent) * 0.5;
+        grid.origin_y = (*min_y + *max_y - extent) * 0.5;
+
+        Parallel::forEach(
+            nodes,
+            [&](std::size_t row) {
+                const double y = grid.origin_y + static_cast<double>(row) * grid.cell_size;
+                for (std::size_t column = 0; column < nodes; ++column)
+                {
+                    const double x = grid.origin_x + static_cast<double>(column) * grid.cell_size;
+                    double acc_x = 0.0;
+                    double acc_y = 0.0;
+                    exact(sources, params, x, y, acc_x, acc_y);
+                    grid.field[row * nodes + column] =
+                        Sample{static_cast<float>(acc_x), static_cast<float>(acc_y)};
+                }
+            },
+            4);
+
+        const auto cells = static_cast<int>(resolution);
+        for (std::size_t s = 0; s < sources.size(); ++s)
+        {
+            const auto column = static_cast<int>((sources.x[s] - grid.origin_x) / grid.cell_size);
+            const auto row = static_cast<int>((sources.y[s] - grid.origin_y) / grid.cell_size);
+            for (int r = std::max(row - NEAR_CELLS, 0); r <= std::min(row + NEAR_CELLS, cells - 1);
+                 ++r)
+            {
+                for (int c = std::max(column - NEAR_CELLS, 0);
+                     c <= std::min(column + NEAR_CELLS, cells - 1); ++c)
+                {
+                    grid.near[static_cast<std::size_t>(r) * resolution + c] = 1;
+                }
+            }
+        }
+        return grid;
+    }
+
+    void sample(double x, double y, double &acc_x, double &acc_y) const
+    {
+        const double u = (x - grid_.origin_x) / grid_.cell_size;
+        const double v = (y - grid_.origin_y) / grid_.cell_size;
+        const auto limit = static_cast<double>(grid_.resolution);
+        if (grid_.field.empty() || !(u >= 0.0 && u < limit && v >= 0.0 && v < limit))
+        {
+            exact(sources_, params_, x, y, acc_x, acc_y);
+            return;
+        }
+        const auto column = static_cast<std::size_t>(u);
+        const auto row = static_cast<std::size_t>(v);
+        if (grid_.near[row * grid_.resolution + column])
+        {
+            exact(sources_, params_, x, y, acc_x, acc_y);
+            return;
+        }
+
+        const std::size_t nodes = grid_.resolution + 1;
+        const std::size_t node = row * nodes + column;
+        const double frac_x = u - static_cast<double>(column);
+        const double frac_y = v - static_cast<double>(row);
+        const double w00 = (1.0 - frac_x) * (1.0 - frac_y);
+        const double w10 = frac_x * (1.0 - frac_y);
+        const double w01 = (1.0 - frac_x) * frac_y;
+        const double w11 = frac_x * frac_y;
+        const Sample *below = grid_.field.data() + node;
+        const Sample *above = below + nodes;
+        acc_x = below[0].x * w00 + below[1].x * w10 + above[0].x * w01 + above[1].x * w11;
+        acc_y = below[0].y * w00 + below[1].y * w10 + above[0].y * w01 + above[1].y * w11;
+    }
+
+    static void exact(const Bodies &sources, const Params &params, double x, double y,
+        double &acc_x, double &acc_y)
+    {
+        const double eps2 = params.softening * params.softening;
+        acc_x = 0.0;
+        acc_y = 0.0;
+        for (std::size_t s = 0; s < sources.size(); ++s)
+        {
+            const double dx = sources.x[s] - x;
+            const double dy = sources.y[s] - y;
+            const double dist2 = dx * dx + dy * dy + eps2;
+            if (dist2 > 0.0)
+            {
+                const double inv_dist = 1.0 / std::sqrt(dist2);
+                const double factor = sources.mass[s] * inv_dist * inv_dist * inv_dist;
+                acc_x += dx * factor;
+                acc_y += dy * factor;
+            }
+        }
+        acc_x *= params.gravity;
+        acc_y *= params.gravity;
+    }
+
+private:
+    std::size_t resolution_{DEFAULT_RESOLUTION};
+    double margin_{DEFAULT_MARGIN};
+    std::size_t min_baked_sources_{DEFAULT_MIN_BAKED_SOURCES};
+    bool baked_{false};
+    Parallel::ThreadPool *pool_{nullptr};
+
+    Bodies sources_;
+    Params params_;
+    // grid of the current sources, empty until their bake has finished
+    Grid grid_;
+    // bake requests so far, and the running bake tagged with the request it serves
+    std::uint64_t request_{0};
+    std::future<std::pair<std::uint64_t, Grid>> running_;
+};
+
+} // namespace Gravity
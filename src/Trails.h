@@ -0,0 +1,489 @@
+#pragma once
+
+#include "ECS.h"
+#include "Parallel.h"
+
+#include <SFML/Graphics/Rect.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Render
+{
+
+// Fixed-capacity trails of many entities in one vertex arena.
+// Every entity owns a slice of the arena holding a ring of its last points. Each point is
+// written twice, at i and i + capacity, so that the ring reads as one contiguous line strip
+// wherever it starts. New positions only add a point once the trail turns by more than the
+// angle tolerance over at least the minimum distance; otherwise the newest point is moved,
+// so straight stretches cost two points however long they are. Every trail keeps a bounding
+// box, and index() sorts the boxes into a grid, so trails away from the view are culled
+// without being visited.
+class TrailArena
+{
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 256;
+    static constexpr float DEFAULT_MIN_DISTANCE = 2.0f;
+    static constexpr float DEFAULT_MAX_ANGLE = 0.07f;
+    static constexpr std::size_t GRID_CELLS_PER_AXIS = 64;
+    // cells a trail may cover along each axis before it is kept out of the grid
+    static constexpr std::size_t MAX_CELLS_PER_TRAIL_AXIS = 8;
+
+    // Points kept per trail; drops every trail.
+    void setCapacity(std::size_t capacity)
+    {
+        assert(capacity >= 2);
+        capacity_ = capacity;
+        clear();
+    }
+    [[nodiscard]] std::size_t getCapacity() const { return capacity_; }
+
+    // Shortest segment that can end in a new point.
+    void setMinDistance(float distance) { min_distance_ = distance; }
+    // Turn, in radians, below which a segment is extended instead of adding a point.
+    void setMaxAngle(float radians) { cos_max_angle_ = std::cos(radians); }
+
+    void clear()
+    {
+        vertices_.clear();
+        slices_.clear();
+        free_slices_.clear();
+        slice_of_.clear();
+        indexed_ = false;
+    }
+
+    void push(Entity entity, sf::Vector2f point, sf::Color color)
+    {
+        indexed_ = false;
+        Slice &slice = slices_[acquire(entity)];
+        slice.pass = pass_;
+        sf::Vertex *ring = vertices_.data() + slice.offset;
+        const sf::Vertex vertex{point, color};
+        if (slice.count >= 2)
+        {
+            const sf::Vector2f anchor = ring[slice.head + slice.count - 2].position;
+            const sf::Vector2f offset = point - anchor;
+            const float distance = std::sqrt(offset.x * offset.x + offset.y * offset.y);
+            bool extend = distance < min_distance_;
+            if (!extend && !slice.has_direction)
+            {
+                // the segment grew long enough to have a direction
+                slice.direction = offset / distance;
+                slice.has_direction = true;
+                extend = true;
+            }
+            else if (!extend)
+            {
+                const float along = offset.x * slice.direction.x + offset.y * slice.direction.y;
+                extend = along >= cos_max_angle_ * distance;
+            }
+            if (extend)
+            {
+                write(slice, slice.count - 1, vertex);
+                expand(slice, point);
+                return;
+            }
+            slice.has_direction = false;
+        }
+
+        const bool dropped = slice.count == capacity_;
+        if (dropped)
+        {
+            slice.head = (slice.head + 1) % static_cast<std::uint32_t>(capacity_);
+            slice.count--;
+        }
+        slice.count++;
+        write(slice, slice.count - 1, vertex);
+        // the box only grows as points are dropped, so it is refit once per lap of the ring
+        if (dropped && slice.head == 0)
+        {
+            refit(slice);
+        }
+        else
+        {
+            expand(slice, point);
+        }
+    }
+
+    // Returns the slice of entity to the arena.
+    void release(Entity entity)
+    {
+        const std::uint32_t index = entityIndex(entity);
+        if (index >= slice_of_.size() || slice_of_[index] == NO_SLICE)
+        {
+            return;
+        }
+        const std::uint32_t slice = slice_of_[index];
+        if (slices_[slice].owner != entity)
+        {
+            return;
+        }
+        slices_[slice].owner = NULL_ENTITY;
+        free_slices_.push_back(slice);
+        slice_of_[index] = NO_SLICE;
+        indexed_ = false;
+    }
+
+    // Releases the trails of the entities that were not pushed since the last call, for
+    // callers that see which entities exist rather than which are destroyed.
+    void releaseUnvisited()
+    {
+        for (const Slice &slice : slices_)
+        {
+            if (slice.owner != NULL_ENTITY && slice.pass != pass_)
+            {
+                release(slice.owner);
+            }
+        }
+        pass_++;
+    }
+
+    // Sorts the trails into a uniform grid over their bounding boxes, registering each in every
+    // cell its box overlaps, so that buildLines only visits the trails in cells overlapping
+    // the view. Trails covering too many cells are kept in a list visited on every call.
+    // Until the next call after a push or release, buildLines visits every trail.
+    void index()
+    {
+        indexed_ = true;
+        wide_slices_.clear();
+        grid_columns_ = 0;
+        grid_rows_ = 0;
+        cell_starts_.assign(1, 0);
+        constexpr float INF = std::numeric_limits<float>::infinity();
+        grid_low_ = {INF, INF};
+        grid_high_ = {-INF, -INF};
+        for (const Slice &slice : slices_)
+        {
+            if (is_drawn(slice))
+            {
+                grid_low_.x = std::min(grid_low_.x, slice.low.x);
+                grid_low_.y = std::min(grid_low_.y, slice.low.y);
+                grid_high_.x = std::max(grid_high_.x, slice.high.x);
+                grid_high_.y = std::max(grid_high_.y, slice.high.y);
+            }
+        }
+        if (grid_low_.x > grid_high_.x)
+        {
+            return;
+        }
+
+        const float extent = std::max(grid_high_.x - grid_low_.x, grid_high_.y - grid_low_.y);
+        grid_cell_ = std::max(extent / static_cast<float>(GRID_CELLS_PER_AXIS), 1e-6f);
+        grid_columns_ = static_cast<std::size_t>((grid_high_.x - grid_low_.x) / grid_cell_) + 1;
+        grid_rows_ = static_cast<std::size_t>((grid_high_.y - grid_low_.y) / grid_cell_) + 1;
+        slice_cells_.resize(slices_.size());
+        cell_starts_.assign(grid_columns_ * grid_rows_ + 1, 0);
+        for (std::size_t s = 0; s < slices_.size(); ++s)
+        {
+            CellRange &range = slice_cells_[s];
+            range = CellRange{};
+            if (!is_drawn(slices_[s]))
+            {
+                continue;
+            }
+            const CellRange cells = range_of(slices_[s].low, slices_[s].high);
+            if (cells.column_end - cells.column_begin > MAX_CELLS_PER_TRAIL_AXIS
+                || cells.row_end - cells.row_begin > MAX_CELLS_PER_TRAIL_AXIS)
+            {
+                wide_slices_.push_back(static_cast<std::uint32_t>(s));
+                continue;
+            }
+            range = cells;
+            for_each_cell(range, [&](std::size_t cell) { cell_starts_[cell + 1]++; });
+        }
+        for (std::size_t c = 0; c < grid_columns_ * grid_rows_; ++c)
+        {
+            cell_starts_[c + 1] += cell_starts_[c];
+        }
+        cell_slices_.resize(cell_starts_.back());
+        cell_cursor_.assign(cell_starts_.begin(), cell_starts_.end() - 1);
+        for (std::size_t s = 0; s < slices_.size(); ++s)
+        {
+            for_each_cell(slice_cells_[s], [&](std::size_t cell) {
+                cell_slices_[cell_cursor_[cell]++] = static_cast<std::uint32_t>(s);
+            });
+        }
+    }
+
+    // Fills lines with the segments of every trail that overlap visible, as vertex pairs for
+    // sf::Lines, so that all trails go out in one draw call. The trails in the visible cells
+    // of the index are converted in parallel; only those crossing the edge of the view test
+    // their segments one by one.
+    void buildLines(std::vector<sf::Vertex> &lines, const sf::FloatRect &visible) const
+    {
+        find_candidates(visible);
+        const std::size_t candidates = candidates_.size();
+        line_offsets_.resize(candidates + 1);
+        line_offsets_[0] = 0;
+        Parallel::forEach(
+            candidates,
+            [&](std::size_t n) {
+                std::size_t segments = 0;
+                for_each_visible_segment(
+                    slices_[candidates_[n]], visible, [&](std::size_t) { segments++; });
+                line_offsets_[n + 1] = 2 * segments;
+            },
+            64);
+        for (std::size_t n = 0; n < candidates; ++n)
+        {
+            line_offsets_[n + 1] += line_offsets_[n];
+        }
+        lines.resize(line_offsets_.back());
+        Parallel::forEach(
+            candidates,
+            [&](std::size_t n) {
+                const Slice &slice = slices_[candidates_[n]];
+                const sf::Vertex *strip = vertices_.data() + slice.offset + slice.head;
+                sf::Vertex *out = lines.data() + line_offsets_[n];
+                for_each_visible_segment(slice, visible, [&](std::size_t k) {
+                    *out++ = strip[k];
+                    *out++ = strip[k + 1];
+                });
+            },
+            64);
+    }
+
+    [[nodiscard]] std::size_t getTrailCount() const
+    {
+        return slices_.size() - free_slices_.size();
+    }
+    [[nodiscard]] std::size_t getArenaSize() const { return vertices_.size(); }
+
+private:
+    struct Slice
+    {
+        Entity owner{NULL_ENTITY};
+        // first vertex of the slice in the arena
+        std::size_t offset{0};
+        // oldest point and the number of points in the ring
+        std::uint32_t head{0};
+        std::uint32_t count{0};
+        // direction of the newest segment, once it is longer than the minimum distance
+        sf::Vector2f direction;
+        bool has_direction{false};
+        // bounding box of the points, possibly larger than needed
+        sf::Vector2f low;
+        sf::Vector2f high;
+        // value of pass_ at the last push
+        std::uint32_t pass{0};
+    };
+
+    // cells [column_begin, column_end) x [row_begin, row_end) of the index
+    struct CellRange
+    {
+        std::size_t column_begin{0};
+        std::size_t column_end{0};
+        std::size_t row_begin{0};
+        std::size_t row_end{0};
+    };
+
+    static constexpr std::uint32_t NO_SLICE = ~std::uint32_t{0};
+
+    [[nodiscard]] static bool is_drawn(const Slice &slice)
+    {
+        return slice.owner != NULL_ENTITY && slice.count >= 2;
+    }
+
+    // Cells of the index overlapping the box from low to high, clamped to the grid.
+    [[nodiscard]] CellRange range_of(sf::Vector2f low, sf::Vector2f high) const
+    {
+        const auto cell_of = [&](float value, float origin, std::size_t cells) {
+            const float index = std::floor((value - origin) / grid_cell_);
+            return static_cast<std::size_t>(
+                std::clamp(index, 0.0f, static_cast<float>(cells - 1)));
+        };
+        return CellRange{cell_of(low.x, grid_low_.x, grid_columns_),
+            cell_of(high.x, grid_low_.x, grid_columns_) + 1,
+            cell_of(low.y, grid_low_.y, grid_rows_), cell_of(high.y, grid_low_.y, grid_rows_) + 1};
+    }
+
+    template<class F>
+    void for_each_cell(const CellRange &range, F &&func) const
+    {
+        for (std::size_t row = range.row_begin; row < range.row_end; ++row)
+        {
+            for (std::size_t column = range.column_begin; column < range.column_end; ++column)
+            {
+                func(row * grid_columns_ + column);
+            }
+        }
+    }
+
+    // Fills candidates_ with the trails registered in the cells overlapping visible and the
+    // wide ones, or with every trail while the index is stale.
+    void find_candidates(const sf::FloatRect &visible) const
+    {
+        candidates_.clear();
+        if (!indexed_)
+        {
+            for (std::size_t s = 0; s < slices_.size(); ++s)
+            {
+                candidates_.push_back(static_cast<std::uint32_t>(s));
+            }
+            return;
+        }
+        candidates_.assign(wide_slices_.begin(), wide_slices_.end());
+        if (grid_columns_ == 0 || !overlaps(grid_low_, grid_high_, visible))
+        {
+            return;
+        }
+        const CellRange view = range_of({visible.left, visible.top},
+            {visible.left + visible.width, visible.top + visible.height});
+        for_each_cell(view, [&](std::size_t cell) {
+            const std::size_t row = cell / grid_columns_;
+            const std::size_t column = cell % grid_columns_;
+            for (std::size_t k = cell_starts_[cell]; k < cell_starts_[cell + 1]; ++k)
+            {
+                // a trail over several visible cells is taken in the first of them only
+                const CellRange &range = slice_cells_[cell_slices_[k]];
+                if (column == std::max(range.column_begin, view.column_begin)
+                    && row == std::max(range.row_begin, view.row_begin))
+                {
+                    candidates_.push_back(cell_slices_[k]);
+                }
+            }
+        });
+    }
+
+    std::uint32_t acquire(Entity entity)
+    {
+        const std::uint32_t index = entityIndex(entity);
+        if (index >= slice_of_.size())
+        {
+            slice_of_.resize(index + 1, NO_SLICE);
+        }
+        std::uint32_t &slice = slice_of_[index];
+        if (slice != NO_SLICE && slices_[slice].owner == entity)
+        {
+            return slice;
+        }
+        if (slice != NO_SLICE)
+        {
+            // the slot was reused by a new entity without the old one being released
+            release(slices_[slice].owner);
+        }
+
+        Slice fresh;
+        fresh.owner = entity;
+        if (!free_slices_.empty())
+        {
+            slice = free_slices_.back();
+            free_slices_.pop_back();
+            fresh.offset = slices_[slice].offset;
+            slices_[slice] = fresh;
+        }
+        else
+        {
+            slice = static_cast<std::uint32_t>(slices_.size());
+            fresh.offset = vertices_.size();
+            slices_.push_back(fresh);
+            vertices_.resize(vertices_.size() + 2 * capacity_);
+        }
+        return slice;
+    }
+
+    static void expand(Slice &slice, sf::Vector2f point)
+    {
+        if (slice.count == 1)
+        {
+            slice.low = point;
+            slice.high = point;
+            return;
+        }
+        slice.low = {std::min(slice.low.x, point.x), std::min(slice.low.y, point.y)};
+        slice.high = {std::max(slice.high.x, point.x), std::max(slice.high.y, point.y)};
+    }
+
+    void refit(Slice &slice) const
+    {
+        const sf::Vertex *strip = vertices_.data() + slice.offset + slice.head;
+        slice.low = strip[0].position;
+        slice.high = strip[0].position;
+        for (std::size_t k = 1; k < slice.count; ++k)
+        {
+            const sf::Vector2f point = strip[k].position;
+            slice.low = {std::min(slice.low.x, point.x), std::min(slice.low.y, point.y)};
+            slice.high = {std::max(slice.high.x, point.x), std::max(slice.high.y, point.y)};
+        }
+    }
+
+    [[nodiscard]] static bool overlaps(sf::Vector2f low, sf::Vector2f high,
+        const sf::FloatRect &visible)
+    {
+        return high.x >= visible.left && low.x <= visible.left + visible.width
+            && high.y >= visible.top && low.y <= visible.top + visible.height;
+    }
+
+    // Calls func(k) for every segment k (from point k to k + 1) of slice that may be visible.
+    template<class F>
+    void for_each_visible_segment(const Slice &slice, const sf::FloatRect &visible,
+        F &&func) const
+    {
+        if (!is_drawn(slice) || !overlaps(slice.low, slice.high, visible))
+        {
+            return;
+        }
+        const bool inside = slice.low.x >= visible.left && slice.low.y >= visible.top
+            && slice.high.x <= visible.left + visible.width
+            && slice.high.y <= visible.top + visible.height;
+        const sf::Vertex *strip = vertices_.data() + slice.offset + slice.head;
+        for (std::size_t k = 0; k + 1 < slice.count; ++k)
+        {
+            const sf::Vector2f a = strip[k].position;
+            const sf::Vector2f b = strip[k + 1].position;
+            if (inside
+                || overlaps({std::min(a.x, b.x), std::min(a.y, b.y)},
+                    {std::max(a.x, b.x), std::max(a.y, b.y)}, visible))
+            {
+                func(k);
+            }
+        }
+    }
+
+    // Writes the point at position in the ring, in both halves of the slice.
+    void write(const Slice &slice, std::uint32_t position, const sf::Vertex &vertex)
+    {
+        const std::size_t at = (slice.head + position) % capacity_;
+        vertices_[slice.offset + at] = vertex;
+        vertices_[slice.offset + at + capacity_] = vertex;
+    }
+
+private:
+    std::size_t capacity_{DEFAULT_CAPACITY};
+    float min_distance_{DEFAULT_MIN_DISTANCE};
+    float cos_max_angle_{std::cos(DEFAULT_MAX_ANGLE)};
+    std::uint32_t pass_{0};
+
+    // 2 * capacity vertices per slice
+    std::vector<sf::Vertex> vertices_;
+    std::vector<Slice> slices_;
+    std::vector<std::uint32_t> free_slices_;
+    // slice of every entity, indexed by entityIndex()
+    std::vector<std::uint32_t> slice_of_;
+
+    // drawn slices counting-sorted into the cells of a grid over their boxes, as of the last
+    // index(), which is current while indexed_ is set
+    bool indexed_{false};
+    sf::Vector2f grid_low_;
+    sf::Vector2f grid_high_;
+    float grid_cell_{1.0f};
+    std::size_t grid_columns_{0};
+    std::size_t grid_rows_{0};
+    std::vector<CellRange> slice_cells_;
+    std::vector<std::size_t> cell_starts_;
+    std::vector<std::size_t> cell_cursor_;
+    std::vector<std::uint32_t> cell_slices_;
+    // drawn slices covering too many cells to be registered in the grid
+    std::vector<std::uint32_t> wide_slices_;
+    // slices buildLines converts
+    mutable std::vector<std::uint32_t> candidates_;
+    // first vertex of every slice in the output of buildLines
+    mutable std::vector<std::size_t> line_offsets_;
+};
+
+} // namespace Render
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace Parallel
+{
+
+// Lock-free handoff of the latest value from one writer thread to one reader thread.
+// Of the three buffers the writer owns one and the reader another; the third sits in the
+// middle. publish() swaps the written buffer into the middle and update() swaps the middle out
+// to the reader, each with a single atomic exchange, so neither side ever waits and the reader
+// always gets the newest complete value. Values the reader had no time for are overwritten.
+template<class T>
+class TripleBuffer
+{
+public:
+    // Writer side: the buffer to fill before publish(). It holds an old value, not necessarily
+    // the last one published.
+    [[nodiscard]] T &getWriteBuffer() { return buffers_[write_]; }
+
+    void publish()
+    {
+        const std::uint8_t previous =
+            middle_.exchange(static_cast<std::uint8_t>(write_ | FRESH), std::memory_order_acq_rel);
+        write_ = previous & INDEX_MASK;
+    }
+
+    // Reader side: takes the newest published buffer, if there is one it has not seen.
+    // Returns whether the read buffer changed.
+    bool update()
+    {
+        if ((middle_.load(std::memory_order_relaxed) & FRESH) == 0)
+        {
+            return false;
+        }
+        const std::uint8_t previous = middle_.exchange(read_, std::memory_order_acq_rel);
+        read_ = previous & INDEX_MASK;
+        return true;
+    }
+
+    [[nodiscard]] const T &getReadBuffer() const { return buffers_[read_]; }
+
+private:
+    static constexpr std::uint8_t INDEX_MASK = 0x3;
+    static constexpr std::uint8_t FRESH = 0x4;
+
+    T buffers_[3];
+    std::uint8_t write_{0};
+    std::uint8_t read_{1};
+    // index of the middle buffer, with FRESH set while it holds a value the reader has not taken
+    std::atomic<std::uint8_t> middle_{2};
+};
+
+} // namespace Parallel
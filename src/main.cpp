@@ -1,12 +1,36 @@
+#include "Autotuner.h"
+#include "BarnesHut.h"
+#include "BlockTimesteps.h"
+#include "Collisions.h"
+#include "DirectGravity.h"
 #include "ECS.h"
+#include "Gravity.h"
+#include "Integrators.h"
+#include "LodGrid.h"
 #include "MathUtils.h"
+#include "Pairwise.h"
+#include "Parallel.h"
+#include "ParticleMesh.h"
+#include "StaticField.h"
+#include "Trails.h"
+#include "TripleBuffer.h"
 
 #include <SFML/Graphics.hpp>
 #include <SFML/System.hpp>
 #include <SFML/Window.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
 
-ECS ecs;
+// archetype chunks keep the components PhysicsSystem gathers every step side by side
+ECS ecs{ComponentStorage::Archetype};
 
 struct Position
 {
@@ -23,112 +47,1284 @@ struct Mass
     double mass{1.0f};
 };
 
+// Tag for bodies that follow the gravity field without sourcing it (debris and the like).
+// Tracers need Position and Velocity; their Mass, if any, is ignored by the physics.
+struct Tracer
+{
+};
+
+// Tag for bodies pinned in place (a star, a planet's anchor). Static bodies need Position and
+// Mass; their field is baked into a grid once and they never move. Bodies that collide with
+// one are absorbed into it.
+struct Static
+{
+};
+
+enum class GravitySolver
+{
+    Direct,
+    BarnesHut,
+    ParticleMesh,
+};
+
+const char *toString(GravitySolver solver)
+{
+    switch (solver)
+    {
+    case GravitySolver::Direct: return "direct";
+    case GravitySolver::BarnesHut: return "Barnes-Hut";
+    case GravitySolver::ParticleMesh: return "particle-mesh";
+    }
+    return "";
+}
+
+// Short-range force added on top of gravity between the sources.
+enum class ShortRangeForce
+{
+    None,
+    SoftRepulsion,
+    LennardJones,
+    Spring,
+};
+
+const char *toString(ShortRangeForce force)
+{
+    switch (force)
+    {
+    case ShortRangeForce::None: return "none";
+    case ShortRangeForce::SoftRepulsion: return "soft repulsion";
+    case ShortRangeForce::LennardJones: return "Lennard-Jones";
+    case ShortRangeForce::Spring: return "spring";
+    }
+    return "";
+}
+
 class PhysicsSystem : public System
 {
 public:
     static constexpr double GRAVITY = 2000;
+    // force evaluations between two full Barnes-Hut rebuilds; the tree is only refitted in
+    // between
+    static constexpr int TREE_REBUILD_INTERVAL = 10;
+    // length of the energy drift runs of reportPrecision
+    static constexpr int DRIFT_STEPS = 100;
+    static constexpr double DRIFT_DT = 1.0 / 600.0;
+    // clustered set of reportPrecision: tight clusters far apart, shuffled, which mixed
+    // precision only handles with spatially coherent tiles
+    static constexpr std::size_t PRECISION_CLUSTERS = 8;
+    static constexpr std::size_t PRECISION_CLUSTER_SIZE = 500;
+    static constexpr double PRECISION_CLUSTER_SPACING = 4e4;
+    // bodies the autotuner compares against direct summation
+    static constexpr std::size_t TUNE_SAMPLES = 128;
+    // timed force passes per candidate, of which the fastest counts
+    static constexpr int TUNE_PASSES = 2;
+    // direct candidates projected to take this many times the best time so far are skipped
+    static constexpr double TUNE_SKIP_FACTOR = 8.0;
+
+    // Everything the autotuner varies.
+    struct SolverConfig
+    {
+        GravitySolver solver{GravitySolver::Direct};
+        Gravity::SimdLevel simd_level{Gravity::SimdLevel::Scalar};
+        Gravity::Precision precision{Gravity::Precision::Double};
+        bool symmetric{false};
+        std::size_t tile_size{Gravity::DirectSolver::DEFAULT_TILE_SIZE};
+        double opening_angle{0.5};
+        std::size_t grid_size{Gravity::ParticleMeshSolver::DEFAULT_GRID_SIZE};
+        std::size_t threads{1};
+    };
+
+    void setSolver(GravitySolver solver)
+    {
+        solver_ = solver;
+        steps_since_build_ = TREE_REBUILD_INTERVAL;
+        acc_valid_ = false;
+    }
+
+    [[nodiscard]] GravitySolver getSolver() const { return solver_; }
+
+    void setIntegrator(Gravity::Integrator integrator) { integrator_ = integrator; }
+    [[nodiscard]] Gravity::Integrator getIntegrator() const { return integrator_; }
+
+    // Individual power-of-two timesteps instead of the selected integrator; only the bodies
+    // that finish a step get their forces recomputed.
+    void setBlockTimesteps(bool enabled) { block_timesteps_ = enabled; }
+    [[nodiscard]] bool isBlockTimesteps() const { return block_timesteps_; }
+
+    [[nodiscard]] Gravity::BlockTimestepper &getBlockTimestepper() { return block_stepper_; }
+
+    // Short-range forces use a Verlet neighbor list that is rebuilt only once a body has moved
+    // more than half its skin.
+    void setShortRangeForce(ShortRangeForce force)
+    {
+        short_range_ = force;
+        acc_valid_ = false;
+    }
+    [[nodiscard]] ShortRangeForce getShortRangeForce() const { return short_range_; }
+
+    void setSoftRepulsion(const Pairwise::SoftRepulsion &law)
+    {
+        soft_repulsion_ = law;
+        acc_valid_ = false;
+    }
+    [[nodiscard]] const Pairwise::SoftRepulsion &getSoftRepulsion() const
+    {
+        return soft_repulsion_;
+    }
+
+    void setLennardJones(const Pairwise::LennardJones &law)
+    {
+        lennard_jones_ = law;
+        acc_valid_ = false;
+    }
+    [[nodiscard]] const Pairwise::LennardJones &getLennardJones() const { return lennard_jones_; }
+
+    void setSpring(const Pairwise::Spring &law)
+    {
+        spring_ = law;
+        acc_valid_ = false;
+    }
+    [[nodiscard]] const Pairwise::Spring &getSpring() const { return spring_; }
+
+    void setNeighborSkin(double skin)
+    {
+        neighbors_.setSkin(skin);
+        acc_valid_ = false;
+    }
+    [[nodiscard]] const Pairwise::NeighborList &getNeighborList() const { return neighbors_; }
+
+    // Overlapping bodies (radius sqrt(mass), as drawn) merge at the end of every update.
+    void setMergeOnCollision(bool enabled) { merge_on_collision_ = enabled; }
+    [[nodiscard]] bool isMergeOnCollision() const { return merge_on_collision_; }
+
+    void setOpeningAngle(double theta)
+    {
+        tree_.setOpeningAngle(theta);
+        acc_valid_ = false;
+    }
+
+    // Worker threads used by every solver; 0 means one per hardware thread.
+    void setThreadCount(std::size_t thread_count) { Parallel::setThreadCount(thread_count); }
+
+    // SIMD level, tiling and symmetric mode of the direct solver.
+    [[nodiscard]] Gravity::DirectSolver &getDirectSolver() { return direct_; }
+
+    // Grid size of the particle-mesh solver.
+    [[nodiscard]] Gravity::ParticleMeshSolver &getParticleMesh() { return mesh_; }
+
+    // Benchmarks the solvers and their settings on the live bodies, one candidate per update,
+    // and keeps the fastest one within the accuracy budget of the tuner. The thread count is
+    // tuned for the winner afterwards. Tuning starts over once the body count has changed by
+    // more than the retune factor.
+    void setAutoTune(bool enabled)
+    {
+        auto_tune_ = enabled;
+        tuner_.reset();
+        tuned_backends_.clear();
+    }
+    [[nodiscard]] bool isAutoTune() const { return auto_tune_; }
+    [[nodiscard]] bool isTuning() const { return auto_tune_ && tuner_.isTuning(); }
+
+    [[nodiscard]] Tuning::Autotuner<SolverConfig> &getAutotuner() { return tuner_; }
+
+    // Resolution, margin and bake pool of the baked field of the static bodies.
+    [[nodiscard]] Gravity::StaticField &getStaticField() { return static_field_; }
 
     void update(double dt)
     {
-        for (const Entity &ent_0 : entities_)
+        gather_bodies();
+        if (auto_tune_ && bodies_.size() > 0)
+        {
+            tune();
+        }
+
+        // the accelerations of the last step still hold unless bodies were added, removed,
+        // merged or moved in between
+        bool acc_valid = acc_valid_;
+
+        if (block_timesteps_)
+        {
+            block_stepper_.advance(bodies_, body_velocities_, accelerations_, acc_valid, dt,
+                [this](const std::vector<std::uint32_t> &active, Gravity::Accelerations &acc) {
+                    compute_accelerations_of(active, acc);
+                });
+        }
+        else
+        {
+            Gravity::integrate(integrator_, bodies_, body_velocities_, accelerations_,
+                acc_valid, dt,
+                [this](Gravity::Accelerations &acc) { compute_accelerations(solver_, acc); });
+        }
+
+        for (std::size_t i = 0; i < bodies_.size(); ++i)
+        {
+            positions_[i]->pos = {bodies_.x[i], bodies_.y[i]};
+            velocities_[i]->velocity = {body_velocities_.x[i], body_velocities_.y[i]};
+        }
+
+        acc_valid_ = acc_valid;
+
+        if (merge_on_collision_)
+        {
+            merge_collisions();
+        }
+    }
+
+    // To be called after writing the Position or Mass of bodies outside update, so that the
+    // next step does not reuse accelerations computed for the old state.
+    void bodiesChanged() { acc_valid_ = false; }
+
+    // Relative error of the selected solver against direct summation on the current state.
+    [[nodiscard]] double measureSolverError()
+    {
+        gather_bodies();
+        Gravity::Accelerations reference;
+        Gravity::Accelerations approx;
+        Gravity::computeDirect(bodies_, get_params(), reference);
+        compute_gravity(solver_, approx);
+        return Gravity::relativeError(reference, approx);
+    }
+
+    // Times the direct force pass on the current bodies in double and in mixed precision, and
+    // integrates them for DRIFT_STEPS leapfrog steps in both modes to compare the energy drift.
+    // The force error of mixed precision is reported for the current bodies and for a set of
+    // shuffled tight clusters far apart. The bodies are restored afterwards.
+    void reportPrecision(std::ostream &out)
+    {
+        gather_bodies();
+        const Gravity::Precision restore_precision = direct_.getPrecision();
+        const GravitySolver restore_solver = solver_;
+        const Gravity::Bodies start_bodies = bodies_;
+        const Gravity::Velocities start_velocities = body_velocities_;
+        solver_ = GravitySolver::Direct;
+
+        out << "direct solver precision, " << bodies_.size() << " bodies, energy drift over "
+            << DRIFT_STEPS << " steps" << std::endl;
+        double double_ms = 0.0;
+        Gravity::Accelerations reference;
+        Gravity::Accelerations approx;
+        for (const Gravity::Precision precision :
+            {Gravity::Precision::Double, Gravity::Precision::Mixed})
         {
-            const auto &pos_0 = ecs.getComponent<Position>(ent_0).pos;
-            auto &speed_0 = ecs.getComponent<Velocity>(ent_0).velocity;
-            const auto &mass_0 = ecs.getComponent<Mass>(ent_0).mass;
+            direct_.setPrecision(precision);
+            const double ms = time_force_pass(GravitySolver::Direct);
+            if (precision == Gravity::Precision::Double)
+            {
+                double_ms = ms;
+                compute_gravity(GravitySolver::Direct, reference);
+            }
+            else
+            {
+                compute_gravity(GravitySolver::Direct, approx);
+            }
+
+            bodies_ = start_bodies;
+            body_velocities_ = start_velocities;
+            const double start_energy = total_energy();
+            bool acc_valid = false;
+            for (int step = 0; step < DRIFT_STEPS; ++step)
+            {
+                Gravity::integrate(Gravity::Integrator::Leapfrog, bodies_, body_velocities_,
+                    accelerations_, acc_valid, DRIFT_DT,
+                    [this](Gravity::Accelerations &acc) { compute_accelerations(solver_, acc); });
+            }
+            const double energy = total_energy();
+            const double drift = std::abs((energy - start_energy) / start_energy);
 
-            for (const Entity &ent_1 : entities_)
+            out << "  " << toString(precision) << ": " << ms << " ms, speedup "
+                << double_ms / ms << ", energy drift " << drift << std::endl;
+        }
+        out << "  mixed force error " << Gravity::relativeError(reference, approx)
+            << ", on " << PRECISION_CLUSTERS << " shuffled clusters "
+            << clustered_mixed_error() << ", budget " << tuner_.getAccuracyBudget()
+            << std::endl;
+
+        bodies_ = start_bodies;
+        body_velocities_ = start_velocities;
+        acc_valid_ = false;
+        solver_ = restore_solver;
+        direct_.setPrecision(restore_precision);
+    }
+
+    // Times the force pass of every solver on the current bodies with 1, 2, 4, ... threads up
+    // to the hardware thread count and prints the speedup over the single-threaded run.
+    void reportScaling(std::ostream &out)
+    {
+        gather_bodies();
+        const std::size_t restore_threads = Parallel::getThreadCount();
+        const std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+        out << "force pass scaling, " << bodies_.size() << " bodies" << std::endl;
+        for (const GravitySolver solver :
+            {GravitySolver::Direct, GravitySolver::BarnesHut, GravitySolver::ParticleMesh})
+        {
+            double single_thread_ms = 0.0;
+            for (std::size_t threads = 1;; threads = std::min(threads * 2, max_threads))
             {
-                if (&ent_0 == &ent_1)
+                Parallel::setThreadCount(threads);
+                const double ms = time_force_pass(solver);
+                if (threads == 1)
                 {
-                    continue;
+                    single_thread_ms = ms;
                 }
+                out << "  " << toString(solver) << ", " << threads << " threads: " << ms
+                    << " ms, speedup " << single_thread_ms / ms << std::endl;
+                if (threads == max_threads)
+                {
+                    break;
+                }
+            }
+        }
+        Parallel::setThreadCount(restore_threads);
+    }
 
-                const auto &pos_1 = ecs.getComponent<Position>(ent_1).pos;
-                auto &speed_1 = ecs.getComponent<Velocity>(ent_1).velocity;
-                const auto &mass_1 = ecs.getComponent<Mass>(ent_1).mass;
+    // Prints every candidate of the last autotuning rounds and the one in use.
+    void reportTuning(std::ostream &out) const
+    {
+        out << "autotuning over " << tuner_.getTunedSize() << " bodies, error budget "
+            << tuner_.getAccuracyBudget() << std::endl;
+        for (const auto *round : {&tuned_backends_, &tuner_.getTrials()})
+        {
+            for (const Tuning::Autotuner<SolverConfig>::Trial &trial : *round)
+            {
+                out << "  ";
+                print_config(out, trial.config);
+                if (trial.measured)
+                {
+                    out << ": " << trial.ms << " ms, error " << trial.error << std::endl;
+                }
+                else
+                {
+                    out << ": skipped" << std::endl;
+                }
+            }
+        }
+        out << "  using ";
+        print_config(out, active_config_);
+        out << std::endl;
+    }
+
+private:
+    [[nodiscard]] static Gravity::Params get_params() { return Gravity::Params{GRAVITY, 0.0}; }
+
+    // Sources first, then the tracers with zero mass; static bodies are kept apart.
+    void gather_bodies()
+    {
+        bodies_.clear();
+        body_velocities_.clear();
+        positions_.clear();
+        velocities_.clear();
+        std::swap(body_entities_, previous_entities_);
+        body_entities_.clear();
+        const auto push = [this](Entity entity, Position &pos, Velocity &speed, double mass) {
+            bodies_.push(pos.pos.x, pos.pos.y, mass);
+            body_velocities_.push(speed.velocity.x, speed.velocity.y);
+            positions_.push_back(&pos);
+            velocities_.push_back(&speed);
+            body_entities_.push_back(entity);
+        };
+        // the entities of a chunk share their signature, so tracers and static bodies are
+        // told apart once per chunk
+        ecs.eachChunk<Position, Velocity, Mass>([&](std::uint32_t count, const Entity *entities,
+                                                    Position *pos, Velocity *speed, Mass *mass) {
+            if (ecs.hasComponent<Tracer>(entities[0]) || ecs.hasComponent<Static>(entities[0]))
+            {
+                return;
+            }
+            for (std::uint32_t i = 0; i < count; ++i)
+            {
+                push(entities[i], pos[i], speed[i], mass[i].mass);
+            }
+        });
+        const std::size_t source_count = bodies_.size();
+        ecs.eachChunk<Position, Velocity, Tracer>([&](std::uint32_t count,
+                                                      const Entity *entities, Position *pos,
+                                                      Velocity *speed, Tracer *) {
+            for (std::uint32_t i = 0; i < count; ++i)
+            {
+                push(entities[i], pos[i], speed[i], 0.0);
+            }
+        });
+        tracer_count_ = bodies_.size() - source_count;
+        if (body_entities_ != previous_entities_)
+        {
+            membership_version_++;
+            acc_valid_ = false;
+        }
+        gather_static_bodies();
+    }
+
+    // Re-bakes the static field when a static body was added or removed since the last bake.
+    // The bake runs in the background; until its grid is in place the field is summed exactly.
+    void gather_static_bodies()
+    {
+        if (static_field_.update())
+        {
+            acc_valid_ = false;
+        }
+        static_entities_.clear();
+        ecs.each<Position, Mass, Static>(
+            [this](Entity entity, const Position &, const Mass &, const Static &) {
+                static_entities_.push_back(entity);
+            });
+        // view order shifts when unrelated entities are destroyed, so compare as sets
+        std::sort(static_entities_.begin(), static_entities_.end());
+        if (static_field_.isBaked() && static_entities_ == baked_entities_)
+        {
+            return;
+        }
+
+        static_bodies_.clear();
+        for (const Entity entity : static_entities_)
+        {
+            const sf::Vector2<double> &pos = ecs.getComponent<Position>(entity).pos;
+            static_bodies_.push(pos.x, pos.y, ecs.getComponent<Mass>(entity).mass);
+        }
+        static_field_.bake(static_bodies_, get_params());
+        baked_entities_ = static_entities_;
+        acc_valid_ = false;
+    }
+
+    // Relative force error of mixed against double precision on PRECISION_CLUSTERS tight
+    // clusters spread PRECISION_CLUSTER_SPACING apart, in shuffled order, with the current
+    // tiling of the direct solver.
+    [[nodiscard]] double clustered_mixed_error()
+    {
+        std::mt19937 rng{1};
+        std::normal_distribution<double> spread(0.0, 10.0);
+        std::vector<std::pair<double, double>> points;
+        for (std::size_t c = 0; c < PRECISION_CLUSTERS; ++c)
+        {
+            const double center_x = static_cast<double>(c % 4) * PRECISION_CLUSTER_SPACING;
+            const double center_y = static_cast<double>(c / 4) * PRECISION_CLUSTER_SPACING;
+            for (std::size_t i = 0; i < PRECISION_CLUSTER_SIZE; ++i)
+            {
+                points.emplace_back(center_x + spread(rng), center_y + spread(rng));
+            }
+        }
+        std::shuffle(points.begin(), points.end(), rng);
+        Gravity::Bodies clusters;
+        for (const auto &[x, y] : points)
+        {
+            clusters.push(x, y, 1.0);
+        }
+
+        const Gravity::Precision restore_precision = direct_.getPrecision();
+        Gravity::Accelerations reference;
+        Gravity::Accelerations approx;
+        direct_.setPrecision(Gravity::Precision::Double);
+        direct_.computeAccelerations(clusters, get_params(), reference);
+        direct_.setPrecision(Gravity::Precision::Mixed);
+        direct_.computeAccelerations(clusters, get_params(), approx);
+        direct_.setPrecision(restore_precision);
+        return Gravity::relativeError(reference, approx);
+    }
 
-                const sf::Vector2<double> dir_from_0_to_1 = pos_1 - pos_0;
-                const double distance = Math::length(dir_from_0_to_1);
-                const double force_module = GRAVITY * mass_0 * mass_1 / distance / distance / distance;
-                sf::Vector2<double> force = dir_from_0_to_1 * force_module;
-                speed_0 += force * dt / mass_0;
+    // Kinetic and potential energy of bodies_, including the potential of the static bodies.
+    [[nodiscard]] double total_energy() const
+    {
+        return Gravity::totalEnergy(bodies_, body_velocities_, get_params())
+            + static_field_.potentialEnergy(bodies_);
+    }
+
+    // Measures the next autotuning candidate, starting a round first if one is due, and leaves
+    // the configuration to step with in place.
+    void tune()
+    {
+        if (!tuner_.isTuning())
+        {
+            if (!tuner_.needsRetune(bodies_.size()))
+            {
+                return;
             }
+            active_config_ = get_config();
+            tuned_backends_.clear();
+            tune_threads_ = false;
+            tuner_.start(get_backend_candidates(), bodies_.size());
+        }
+
+        // direct summation at a few bodies, also timed to project the cost of a full pass
+        using Clock = std::chrono::steady_clock;
+        const std::size_t samples = std::min(TUNE_SAMPLES, bodies_.size());
+        tune_x_.resize(samples);
+        tune_y_.resize(samples);
+        for (std::size_t k = 0; k < samples; ++k)
+        {
+            tune_x_[k] = bodies_.x[k * bodies_.size() / samples];
+            tune_y_[k] = bodies_.y[k * bodies_.size() / samples];
         }
+        SolverConfig reference_config = active_config_;
+        reference_config.simd_level = Gravity::detectSimdLevel();
+        reference_config.precision = Gravity::Precision::Double;
+        apply_config(reference_config);
+        const Clock::time_point reference_start = Clock::now();
+        direct_.computeAccelerationsAt(get_sources(), tune_x_.data(), tune_y_.data(), samples,
+            get_params(), tune_reference_);
+        const double reference_ms =
+            std::chrono::duration<double, std::milli>(Clock::now() - reference_start).count();
+
+        const SolverConfig candidate = tuner_.getCandidate();
+        const double projected_ms =
+            reference_ms * static_cast<double>(bodies_.size()) / static_cast<double>(samples);
+        if (candidate.solver == GravitySolver::Direct
+            && projected_ms > TUNE_SKIP_FACTOR * tuner_.getBestMs())
+        {
+            tuner_.skip();
+        }
+        else
+        {
+            apply_config(candidate);
+            double ms = std::numeric_limits<double>::infinity();
+            for (int pass = 0; pass < TUNE_PASSES; ++pass)
+            {
+                const Clock::time_point start = Clock::now();
+                compute_gravity(candidate.solver, tune_acc_);
+                ms = std::min(ms,
+                    std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+            }
+            tune_approx_.reset(samples);
+            for (std::size_t k = 0; k < samples; ++k)
+            {
+                tune_approx_.x[k] = tune_acc_.x[k * bodies_.size() / samples];
+                tune_approx_.y[k] = tune_acc_.y[k * bodies_.size() / samples];
+            }
+            tuner_.record(ms, Gravity::relativeError(tune_reference_, tune_approx_));
+        }
+
+        // the best candidate so far takes over the stepping as soon as it meets the budget
+        if (tuner_.hasBest()
+            && (!tuner_.isTuning() || tuner_.getBest().error <= tuner_.getAccuracyBudget()))
+        {
+            active_config_ = tuner_.getBest().config;
+        }
+        if (!tuner_.isTuning() && tuner_.hasBest() && !tune_threads_)
+        {
+            tune_threads_ = true;
+            tuned_backends_ = tuner_.getTrials();
+            tuner_.start(get_thread_candidates(), bodies_.size());
+        }
+        apply_config(active_config_);
+    }
+
+    [[nodiscard]] std::vector<SolverConfig> get_backend_candidates() const
+    {
+        std::vector<SolverConfig> candidates;
+        SolverConfig config = active_config_;
+        // cheap candidates first, so that hopeless direct ones can be skipped
+        // meshes with many more cells than bodies are not worth timing
+        config.solver = GravitySolver::ParticleMesh;
+        for (const std::size_t grid_size : {128, 256, 512, 1024})
+        {
+            if (grid_size == 128 || grid_size * grid_size <= 4 * bodies_.size())
+            {
+                config.grid_size = grid_size;
+                candidates.push_back(config);
+            }
+        }
+        config.solver = GravitySolver::BarnesHut;
+        for (const double opening_angle : {0.3, 0.5, 0.7, 1.0})
+        {
+            config.opening_angle = opening_angle;
+            candidates.push_back(config);
+        }
+        config.solver = GravitySolver::Direct;
+        const Gravity::SimdLevel widest = Gravity::detectSimdLevel();
+        for (int level = 0; level <= static_cast<int>(widest); ++level)
+        {
+            config.simd_level = static_cast<Gravity::SimdLevel>(level);
+            for (const std::size_t tile_size : {128, 1024})
+            {
+                config.tile_size = tile_size;
+                config.precision = Gravity::Precision::Double;
+                for (const bool symmetric : {false, true})
+                {
+                    config.symmetric = symmetric;
+                    candidates.push_back(config);
+                }
+                config.symmetric = false;
+                config.precision = Gravity::Precision::Mixed;
+                candidates.push_back(config);
+            }
+        }
+        return candidates;
+    }
+
+    // The chosen configuration with 1, 2, 4, ... threads up to the hardware thread count.
+    [[nodiscard]] std::vector<SolverConfig> get_thread_candidates() const
+    {
+        std::vector<SolverConfig> candidates;
+        SolverConfig config = active_config_;
+        const std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+        for (std::size_t threads = 1;; threads = std::min(threads * 2, max_threads))
+        {
+            config.threads = threads;
+            candidates.push_back(config);
+            if (threads == max_threads)
+            {
+                break;
+            }
+        }
+        return candidates;
+    }
+
+    [[nodiscard]] SolverConfig get_config() const
+    {
+        SolverConfig config;
+        config.solver = solver_;
+        config.simd_level = direct_.getSimdLevel();
+        config.precision = direct_.getPrecision();
+        config.symmetric = direct_.isSymmetric();
+        config.tile_size = direct_.getTileSize();
+        config.opening_angle = tree_.getOpeningAngle();
+        config.grid_size = mesh_.getGridSize();
+        config.threads = Parallel::getThreadCount();
+        return config;
+    }
+
+    void apply_config(const SolverConfig &config)
+    {
+        if (config.solver != solver_)
+        {
+            setSolver(config.solver);
+        }
+        direct_.setSimdLevel(config.simd_level);
+        direct_.setPrecision(config.precision);
+        direct_.setSymmetric(config.symmetric);
+        direct_.setTileSize(config.tile_size);
+        tree_.setOpeningAngle(config.opening_angle);
+        mesh_.setGridSize(config.grid_size);
+        Parallel::setThreadCount(config.threads);
+        acc_valid_ = false;
+    }
+
+    static void print_config(std::ostream &out, const SolverConfig &config)
+    {
+        out << toString(config.solver);
+        switch (config.solver)
+        {
+        case GravitySolver::Direct:
+            out << " " << toString(config.simd_level) << " " << toString(config.precision)
+                << (config.symmetric ? " symmetric" : "") << ", tile " << config.tile_size;
+            break;
+        case GravitySolver::BarnesHut: out << ", theta " << config.opening_angle; break;
+        case GravitySolver::ParticleMesh:
+            out << ", " << config.grid_size << "^2 grid";
+            break;
+        }
+        out << ", " << config.threads << " threads";
+    }
+
+    // Average wall time of compute_gravity over enough runs to fill ~100 ms.
+    double time_force_pass(GravitySolver solver)
+    {
+        using Clock = std::chrono::steady_clock;
+        Gravity::Accelerations acc;
+        compute_gravity(solver, acc);
 
-        for (const Entity &ent : entities_)
+        int runs = 0;
+        const Clock::time_point start = Clock::now();
+        Clock::duration elapsed{};
+        while (runs < 3 || elapsed < std::chrono::milliseconds(100))
         {
-            auto &pos = ecs.getComponent<Position>(ent).pos;
-            const auto &speed = ecs.getComponent<Velocity>(ent).velocity;
-            pos += speed * dt;
+            compute_gravity(solver, acc);
+            runs++;
+            elapsed = Clock::now() - start;
         }
+        return std::chrono::duration<double, std::milli>(elapsed).count() / runs;
     }
+
+    void compute_accelerations(GravitySolver solver, Gravity::Accelerations &acc)
+    {
+        compute_gravity(solver, acc);
+        static_field_.addAccelerations(bodies_.x.data(), bodies_.y.data(), bodies_.size(), acc);
+        add_short_range(acc);
+    }
+
+    void compute_gravity(GravitySolver solver, Gravity::Accelerations &acc)
+    {
+        // with tracers around, only the sources feed the solver and every body is a target
+        if (tracer_count_ > 0)
+        {
+            compute_accelerations_at(solver, bodies_.x.data(), bodies_.y.data(), bodies_.size(),
+                acc);
+            return;
+        }
+
+        const Gravity::Params params = get_params();
+        switch (solver)
+        {
+        case GravitySolver::Direct: direct_.computeAccelerations(bodies_, params, acc); break;
+        case GravitySolver::BarnesHut:
+            update_tree(bodies_);
+            tree_.computeAccelerations(bodies_, params, acc);
+            break;
+        case GravitySolver::ParticleMesh: mesh_.computeAccelerations(bodies_, params, acc); break;
+        }
+    }
+
+    // Accelerations of the listed bodies only (ascending indices into bodies_).
+    void compute_accelerations_of(const std::vector<std::uint32_t> &active,
+        Gravity::Accelerations &acc)
+    {
+        if (active.size() == bodies_.size())
+        {
+            compute_accelerations(solver_, acc);
+            return;
+        }
+
+        target_x_.clear();
+        target_y_.clear();
+        for (const std::uint32_t body : active)
+        {
+            target_x_.push_back(bodies_.x[body]);
+            target_y_.push_back(bodies_.y[body]);
+        }
+        compute_accelerations_at(solver_, target_x_.data(), target_y_.data(), active.size(),
+            acc);
+        static_field_.addAccelerations(target_x_.data(), target_y_.data(), active.size(), acc);
+
+        if (short_range_ != ShortRangeForce::None)
+        {
+            short_range_acc_.reset(bodies_.size());
+            add_short_range(short_range_acc_);
+            for (std::size_t k = 0; k < active.size(); ++k)
+            {
+                acc.x[k] += short_range_acc_.x[active[k]];
+                acc.y[k] += short_range_acc_.y[active[k]];
+            }
+        }
+    }
+
+    // Adds the short-range force between the sources, which come first in acc.
+    void add_short_range(Gravity::Accelerations &acc)
+    {
+        if (short_range_ == ShortRangeForce::None)
+        {
+            return;
+        }
+        const Gravity::Bodies &sources = get_sources();
+        if (neighbor_version_ != membership_version_)
+        {
+            neighbors_.invalidate();
+            neighbor_version_ = membership_version_;
+        }
+        switch (short_range_)
+        {
+        case ShortRangeForce::None: break;
+        case ShortRangeForce::SoftRepulsion: add_short_range(sources, soft_repulsion_, acc); break;
+        case ShortRangeForce::LennardJones: add_short_range(sources, lennard_jones_, acc); break;
+        case ShortRangeForce::Spring: add_short_range(sources, spring_, acc); break;
+        }
+    }
+
+    template<class Law>
+    void add_short_range(const Gravity::Bodies &sources, const Law &law,
+        Gravity::Accelerations &acc)
+    {
+        neighbors_.update(sources, law.cutoff());
+        Pairwise::addNeighborPairs(sources, law, neighbors_, acc);
+    }
+
+    // Accelerations at arbitrary points due to the sources.
+    void compute_accelerations_at(GravitySolver solver, const double *target_x,
+        const double *target_y, std::size_t target_count, Gravity::Accelerations &acc)
+    {
+        const Gravity::Bodies &sources = get_sources();
+        const Gravity::Params params = get_params();
+        switch (solver)
+        {
+        case GravitySolver::Direct:
+            direct_.computeAccelerationsAt(sources, target_x, target_y, target_count, params,
+                acc);
+            break;
+        case GravitySolver::BarnesHut:
+            update_tree(sources);
+            tree_.computeAccelerationsAt(sources, target_x, target_y, target_count, params, acc);
+            break;
+        case GravitySolver::ParticleMesh:
+            mesh_.computeAccelerationsAt(sources, target_x, target_y, target_count, params, acc);
+            break;
+        }
+    }
+
+    // Merges every group of overlapping sources into its heaviest member, conserving mass,
+    // momentum and the center of mass; the other members are destroyed in one batch.
+    // Static bodies take part as candidates after the sources: a group touching one is
+    // absorbed into it, its momentum going into the pinned body, and the field is re-baked.
+    // Static bodies never merge with each other.
+    void merge_collisions()
+    {
+        const std::size_t count = bodies_.size() - tracer_count_;
+        const std::size_t static_count = static_bodies_.size();
+        const std::size_t candidates = count + static_count;
+        radii_.resize(candidates);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            radii_[i] = std::sqrt(bodies_.mass[i]);
+        }
+        const double *x = bodies_.x.data();
+        const double *y = bodies_.y.data();
+        if (static_count > 0)
+        {
+            merge_x_.assign(bodies_.x.begin(), bodies_.x.begin() + count);
+            merge_y_.assign(bodies_.y.begin(), bodies_.y.begin() + count);
+            merge_x_.insert(merge_x_.end(), static_bodies_.x.begin(), static_bodies_.x.end());
+            merge_y_.insert(merge_y_.end(), static_bodies_.y.begin(), static_bodies_.y.end());
+            for (std::size_t s = 0; s < static_count; ++s)
+            {
+                radii_[count + s] = std::sqrt(static_bodies_.mass[s]);
+            }
+            x = merge_x_.data();
+            y = merge_y_.data();
+        }
+        broadphase_.findOverlaps(x, y, radii_.data(), candidates, contacts_);
+        if (contacts_.empty())
+        {
+            return;
+        }
+
+        // union-find over the contacts, so that chains of touching bodies merge as one; the
+        // heavier root wins, which makes every root the heaviest body of its group, unless a
+        // static body is part of it
+        const auto is_static = [count](std::uint32_t body) { return body >= count; };
+        merge_roots_.resize(candidates);
+        std::iota(merge_roots_.begin(), merge_roots_.end(), 0u);
+        const auto find_root = [this](std::uint32_t body) {
+            while (merge_roots_[body] != body)
+            {
+                merge_roots_[body] = merge_roots_[merge_roots_[body]];
+                body = merge_roots_[body];
+            }
+            return body;
+        };
+        for (const Collision::Pair &contact : contacts_)
+        {
+            const std::uint32_t a = find_root(contact.a);
+            const std::uint32_t b = find_root(contact.b);
+            if (a == b || (is_static(a) && is_static(b)))
+            {
+                continue;
+            }
+            const bool a_wins = is_static(a)
+                || (!is_static(b)
+                    && (bodies_.mass[a] > bodies_.mass[b]
+                        || (bodies_.mass[a] == bodies_.mass[b] && a < b)));
+            merge_roots_[a_wins ? b : a] = a_wins ? a : b;
+        }
+
+        // per-root sums of mass, mass * position and momentum
+        merge_sums_.assign(candidates, MergeSum{});
+        destroyed_.clear();
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            const std::uint32_t root = find_root(i);
+            MergeSum &sum = merge_sums_[root];
+            const double mass = bodies_.mass[i];
+            sum.mass += mass;
+            sum.mass_x += mass * bodies_.x[i];
+            sum.mass_y += mass * bodies_.y[i];
+            sum.momentum_x += mass * body_velocities_.x[i];
+            sum.momentum_y += mass * body_velocities_.y[i];
+            if (root != i)
+            {
+                sum.merged = true;
+                destroyed_.push_back(body_entities_[i]);
+            }
+        }
+
+        // component pointers stay valid until the batch below is destroyed
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            const MergeSum &sum = merge_sums_[i];
+            if (!sum.merged || sum.mass <= 0.0)
+            {
+                continue;
+            }
+            positions_[i]->pos = {sum.mass_x / sum.mass, sum.mass_y / sum.mass};
+            velocities_[i]->velocity = {sum.momentum_x / sum.mass, sum.momentum_y / sum.mass};
+            ecs.getComponent<Mass>(body_entities_[i]).mass = sum.mass;
+        }
+        for (std::size_t s = 0; s < static_count; ++s)
+        {
+            const MergeSum &sum = merge_sums_[count + s];
+            if (!sum.merged)
+            {
+                continue;
+            }
+            static_bodies_.mass[s] += sum.mass;
+            ecs.getComponent<Mass>(baked_entities_[s]).mass = static_bodies_.mass[s];
+            static_field_.invalidate();
+        }
+        ecs.destroyEntities(destroyed_);
+        acc_valid_ = false;
+    }
+
+    // The bodies that exert gravity: bodies_ without the tracers at its end.
+    const Gravity::Bodies &get_sources()
+    {
+        if (tracer_count_ == 0)
+        {
+            return bodies_;
+        }
+        const std::size_t count = bodies_.size() - tracer_count_;
+        sources_.x.assign(bodies_.x.begin(), bodies_.x.begin() + count);
+        sources_.y.assign(bodies_.y.begin(), bodies_.y.begin() + count);
+        sources_.mass.assign(bodies_.mass.begin(), bodies_.mass.begin() + count);
+        return sources_;
+    }
+
+    void update_tree(const Gravity::Bodies &sources)
+    {
+        if (steps_since_build_ >= TREE_REBUILD_INTERVAL || tree_version_ != membership_version_)
+        {
+            tree_.build(sources);
+            tree_version_ = membership_version_;
+            steps_since_build_ = 0;
+        }
+        else
+        {
+            tree_.refit(sources);
+        }
+        steps_since_build_++;
+    }
+
+private:
+    GravitySolver solver_{GravitySolver::Direct};
+    Gravity::Integrator integrator_{Gravity::Integrator::SemiImplicitEuler};
+
+    // SoA copies of the components, in view order
+    Gravity::Bodies bodies_;
+    Gravity::Velocities body_velocities_;
+    Gravity::Accelerations accelerations_;
+    std::vector<Position *> positions_;
+    std::vector<Velocity *> velocities_;
+    std::vector<Entity> body_entities_;
+    // body_entities_ of the previous gather, and a count of the changes between gathers
+    std::vector<Entity> previous_entities_;
+    std::uint64_t membership_version_{0};
+    // trailing entries of bodies_ that feel gravity but do not exert it
+    std::size_t tracer_count_{0};
+    Gravity::Bodies sources_;
+
+    // whether accelerations_ still match the bodies; reused by the next leapfrog step
+    bool acc_valid_{false};
+
+    bool block_timesteps_{false};
+    Gravity::BlockTimestepper block_stepper_;
+    // positions of the active bodies of a block substep
+    std::vector<double> target_x_;
+    std::vector<double> target_y_;
+
+    Gravity::DirectSolver direct_;
+    Gravity::BarnesHutTree tree_;
+    // membership version the tree was built for
+    std::uint64_t tree_version_{0};
+    int steps_since_build_{TREE_REBUILD_INTERVAL};
+
+    Gravity::ParticleMeshSolver mesh_;
+
+    bool auto_tune_{false};
+    Tuning::Autotuner<SolverConfig> tuner_;
+    // whether the running round is the thread count one, and the finished backend round
+    bool tune_threads_{false};
+    std::vector<Tuning::Autotuner<SolverConfig>::Trial> tuned_backends_;
+    // configuration used for stepping: the one in place when tuning started until a candidate
+    // meets the budget, then the best
+    SolverConfig active_config_;
+    std::vector<double> tune_x_;
+    std::vector<double> tune_y_;
+    Gravity::Accelerations tune_reference_;
+    Gravity::Accelerations tune_approx_;
+    Gravity::Accelerations tune_acc_;
+
+    Gravity::StaticField static_field_;
+    Gravity::Bodies static_bodies_;
+    // static bodies of this update and of the last bake, sorted
+    std::vector<Entity> static_entities_;
+    std::vector<Entity> baked_entities_;
+
+    ShortRangeForce short_range_{ShortRangeForce::None};
+    Pairwise::SoftRepulsion soft_repulsion_{20000.0, 10.0};
+    Pairwise::LennardJones lennard_jones_{2000.0, 6.0, 2.5};
+    Pairwise::Spring spring_{400.0, 8.0, 16.0};
+    Pairwise::NeighborList neighbors_;
+    // membership version the neighbor list was built for
+    std::uint64_t neighbor_version_{0};
+    Gravity::Accelerations short_range_acc_;
+
+    struct MergeSum
+    {
+        double mass{0.0};
+        double mass_x{0.0};
+        double mass_y{0.0};
+        double momentum_x{0.0};
+        double momentum_y{0.0};
+        bool merged{false};
+    };
+
+    bool merge_on_collision_{true};
+    Collision::SpatialHash broadphase_;
+    std::vector<double> radii_;
+    // positions of the sources followed by the static bodies, when there are any
+    std::vector<double> merge_x_;
+    std::vector<double> merge_y_;
+    std::vector<Collision::Pair> contacts_;
+    std::vector<std::uint32_t> merge_roots_;
+    std::vector<MergeSum> merge_sums_;
+    std::vector<Entity> destroyed_;
+};
+
+
+// What RenderSystem draws, copied out of the ECS by the simulation thread after each step:
+// the bodies first, then the tracers with a radius of 0. Every entity also has its position
+// in the previous snapshot, so that frames falling between two steps can be interpolated.
+struct RenderSnapshot
+{
+    std::vector<Entity> entities;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> previous_x;
+    std::vector<float> previous_y;
+    std::vector<float> radius;
+    std::size_t body_count{0};
+    // wall-clock time the state was captured at, and the simulated time since the previous
+    // snapshot (0 when the simulation did not advance)
+    std::chrono::steady_clock::time_point time;
+    double step{0.0};
 };
 
+// Fills RenderSnapshots from the ECS on the simulation thread, remembering the last captured
+// position of every entity.
+class SnapshotWriter
+{
+public:
+    void capture(RenderSnapshot &snapshot, double step)
+    {
+        snapshot.entities.clear();
+        snapshot.x.clear();
+        snapshot.y.clear();
+        snapshot.previous_x.clear();
+        snapshot.previous_y.clear();
+        snapshot.radius.clear();
+        // tracers count as tracers even with a Mass, as in PhysicsSystem; a chunk shares its
+        // signature, so they are told apart once per chunk
+        ecs.eachChunk<Position, Mass>(
+            [&](std::uint32_t count, const Entity *entities, Position *pos, Mass *mass) {
+                if (ecs.hasComponent<Tracer>(entities[0]))
+                {
+                    return;
+                }
+                for (std::uint32_t i = 0; i < count; ++i)
+                {
+                    add(snapshot, entities[i], pos[i], std::sqrt((float)mass[i].mass));
+                }
+            });
+        snapshot.body_count = snapshot.entities.size();
+        ecs.each<Position, Tracer>([&](Entity entity, const Position &pos, const Tracer &) {
+            add(snapshot, entity, pos, 0.0f);
+        });
+        snapshot.time = std::chrono::steady_clock::now();
+        snapshot.step = step;
+    }
+
+private:
+    // Entities new since the last capture start where they are.
+    void add(RenderSnapshot &snapshot, Entity entity, const Position &pos, float size)
+    {
+        const std::uint32_t index = entityIndex(entity);
+        if (index >= last_owner_.size())
+        {
+            last_owner_.resize(index + 1, NULL_ENTITY);
+            last_x_.resize(index + 1);
+            last_y_.resize(index + 1);
+        }
+        const auto x = (float)pos.pos.x;
+        const auto y = (float)pos.pos.y;
+        const bool known = last_owner_[index] == entity;
+        snapshot.entities.push_back(entity);
+        snapshot.x.push_back(x);
+        snapshot.y.push_back(y);
+        snapshot.previous_x.push_back(known ? last_x_[index] : x);
+        snapshot.previous_y.push_back(known ? last_y_[index] : y);
+        snapshot.radius.push_back(size);
+        last_owner_[index] = entity;
+        last_x_[index] = x;
+        last_y_[index] = y;
+    }
+
+private:
+    // last captured position of every entity, indexed by entityIndex()
+    std::vector<Entity> last_owner_;
+    std::vector<float> last_x_;
+    std::vector<float> last_y_;
+};
+
+// Work the window thread hands over to the simulation thread, which owns the ECS.
+// The lock only covers handing over the list, never a command or a step, so posting does not
+// wait for the simulation.
+class CommandQueue
+{
+public:
+    void post(std::function<void()> command)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(std::move(command));
+    }
+
+    // Runs the commands posted so far; returns whether there were any.
+    bool runPending()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(pending_, running_);
+        }
+        for (std::function<void()> &command : running_)
+        {
+            command();
+        }
+        const bool any = !running_.empty();
+        running_.clear();
+        return any;
+    }
 
-class RenderSystem
-    : public System
-    , public sf::Drawable
+private:
+    std::mutex mutex_;
+    std::vector<std::function<void()>> pending_;
+    std::vector<std::function<void()>> running_;
+};
+
+// Draws the latest RenderSnapshot on the window thread. It never reads the ECS, so the
+// simulation keeps stepping while a frame is drawn.
+// Frames show the state one step behind the simulation, blended between the previous and the
+// current positions by the time elapsed since the snapshot, so motion stays smooth when the
+// display refreshes faster than the simulation steps.
+class RenderSystem : public sf::Drawable
 {
 public:
-    void updateTrails()
+    // Draws snapshot from now on and extends the trails of its bodies; the trails of bodies
+    // missing from it are released. The bodies, tracers and trails are binned here, once per
+    // snapshot, so frames only visit what is in view. snapshot must stay unchanged until the
+    // next call.
+    void setSnapshot(const RenderSnapshot &snapshot)
     {
-        for (const Entity &entity : entities_)
+        snapshot_ = &snapshot;
+        // the trails end at the previous positions, behind the interpolated bodies
+        for (std::size_t i = 0; i < snapshot.body_count; ++i)
         {
-            const auto &pos = ecs.getComponent<Position>(entity).pos;
-            entity_trails_[entity].emplace_back((sf::Vector2f)pos, sf::Color::Cyan);
+            trails_.push(snapshot.entities[i], {snapshot.previous_x[i], snapshot.previous_y[i]},
+                sf::Color::Cyan);
         }
+        trails_.releaseUnvisited();
+        trails_.index();
+
+        const std::size_t bodies = snapshot.body_count;
+        body_lod_.bin({snapshot.x.data(), snapshot.y.data(), snapshot.previous_x.data(),
+            snapshot.previous_y.data(), snapshot.radius.data(), bodies});
+        tracer_lod_.bin({snapshot.x.data() + bodies, snapshot.y.data() + bodies,
+            snapshot.previous_x.data() + bodies, snapshot.previous_y.data() + bodies,
+            snapshot.radius.data() + bodies, snapshot.entities.size() - bodies});
     }
 
+    [[nodiscard]] Render::TrailArena &getTrails() { return trails_; }
+
+    // Three draw calls whatever the number of entities: the visible trail segments, then the
+    // visible bodies and tracers as textured quads and as points, each batch filled in
+    // parallel. Bodies below a pixel become points and dense clusters of them impostors.
     void draw(sf::RenderTarget &target, sf::RenderStates states) const override
     {
-        for (const Entity &entity : entities_)
+        const sf::View &view = target.getView();
+        const sf::FloatRect visible(view.getCenter() - view.getSize() / 2.0f, view.getSize());
+        const float pixel_size = view.getSize().x / static_cast<float>(target.getSize().x);
+
+        trails_.buildLines(trail_lines_, visible);
+        target.draw(trail_lines_.data(), trail_lines_.size(), sf::Lines, states);
+        if (snapshot_ == nullptr)
+        {
+            return;
+        }
+
+        quads_.clear();
+        points_.clear();
+        const float alpha = get_alpha(*snapshot_);
+        const auto texture_size = (float)DISC_TEXTURE_SIZE;
+        body_lod_.build(alpha, visible, pixel_size, texture_size, sf::Color::White, quads_,
+            points_);
+        tracer_lod_.build(alpha, visible, pixel_size, texture_size, sf::Color(160, 160, 160),
+            quads_, points_);
+
+        sf::RenderStates disc_states = states;
+        disc_states.texture = &get_disc_texture();
+        target.draw(quads_.data(), quads_.size(), sf::Quads, disc_states);
+        target.draw(points_.data(), points_.size(), sf::Points, states);
+    }
+
+private:
+    // edge length of the disc texture drawn on every body quad
+    static constexpr unsigned DISC_TEXTURE_SIZE = 64;
+
+    // How far the current frame is into the step that follows snapshot, from 0 at its
+    // previous positions to 1 at its current ones.
+    static float get_alpha(const RenderSnapshot &snapshot)
+    {
+        if (snapshot.step <= 0.0)
         {
-            // draw trail
-            auto it = entity_trails_.find(entity);
-            if (it != entity_trails_.end())
+            return 1.0f;
+        }
+        const double elapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - snapshot.time).count();
+        return (float)std::clamp(elapsed / snapshot.step, 0.0, 1.0);
+    }
+
+    // A white disc with an antialiased edge, created on first use since it needs a GL context.
+    const sf::Texture &get_disc_texture() const
+    {
+        if (disc_texture_.getSize().x == 0)
+        {
+            const float center = DISC_TEXTURE_SIZE / 2.0f;
+            sf::Image image;
+            image.create(DISC_TEXTURE_SIZE, DISC_TEXTURE_SIZE, sf::Color::Transparent);
+            for (unsigned y = 0; y < DISC_TEXTURE_SIZE; ++y)
             {
-                const auto &trail = it->second;
-                target.draw(trail.data(), trail.size(), sf::LineStrip, states);
+                for (unsigned x = 0; x < DISC_TEXTURE_SIZE; ++x)
+                {
+                    const float dx = x + 0.5f - center;
+                    const float dy = y + 0.5f - center;
+                    const float coverage =
+                        std::clamp(center - std::sqrt(dx * dx + dy * dy) + 0.5f, 0.0f, 1.0f);
+                    image.setPixel(x, y, sf::Color(255, 255, 255, (sf::Uint8)(coverage * 255)));
+                }
             }
-
-            // draw object
-            sf::CircleShape shape{};
-            const auto &pos = ecs.getComponent<Position>(entity).pos;
-            const auto &mass = ecs.getComponent<Mass>(entity).mass;
-            shape.setPosition((sf::Vector2f)pos);
-            const float radius = std::sqrt((float)mass);
-            shape.setRadius(radius);
-            shape.setOrigin(Math::getBoundCenter(shape));
-            target.draw(shape, states);
+            disc_texture_.loadFromImage(image);
+            disc_texture_.setSmooth(true);
         }
+        return disc_texture_;
     }
 
 private:
-    std::unordered_map<Entity, std::vector<sf::Vertex>> entity_trails_;
+    const RenderSnapshot *snapshot_{nullptr};
+    Render::TrailArena trails_;
+    Render::LodGrid body_lod_;
+    Render::LodGrid tracer_lod_;
+    // batches of draw, kept between frames
+    mutable std::vector<sf::Vertex> trail_lines_;
+    mutable std::vector<sf::Vertex> quads_;
+    mutable std::vector<sf::Vertex> points_;
+    mutable sf::Texture disc_texture_;
 };
 
-DECLARE_TYPE_INFO(Position);
-DECLARE_TYPE_INFO(Mass);
-DECLARE_TYPE_INFO(Velocity);
-
-DECLARE_TYPE_INFO(PhysicsSystem);
-DECLARE_TYPE_INFO(RenderSystem);
-
 int main()
 {
     sf::RenderWindow window(sf::VideoMode(1024, 768), "ecs");
     window.setVerticalSyncEnabled(true);
 
-    ecs.registerComponents<Position, Mass, Velocity>();
+    ecs.registerComponents<Position, Mass, Velocity, Tracer, Static>();
 
     ecs.registerSystem<PhysicsSystem>();
     ecs.setSystemComponents<PhysicsSystem, Position, Mass, Velocity>();
 
-    ecs.registerSystem<RenderSystem>();
-    ecs.setSystemComponents<RenderSystem, Position, Mass>();
-
+    // solver autotuning is off until U is pressed, as its trial passes slow the first steps
     auto *physic_sys = ecs.getSystem<PhysicsSystem>();
-    auto *render_sys = ecs.getSystem<RenderSystem>();
+    RenderSystem render_sys;
 
     const auto create_ent = [](sf::Vector2<double> pos, sf::Vector2<double> vel, double mass) {
         const Entity ent = ecs.createEntity();
@@ -137,11 +1333,44 @@ int main()
         ecs.addComponent<Mass>(ent, Mass{mass});
     };
 
+    // bodies on circular orbits around the origin, as if all of central_mass sat there;
+    // a mass of 0 makes tracers
+    const auto create_disc = [](std::size_t count, double central_mass, double mass) {
+        std::mt19937 rng{std::random_device{}()};
+        std::uniform_real_distribution<double> radius_dist(150.0, 600.0);
+        std::uniform_real_distribution<double> angle_dist(0.0, 2.0 * 3.14159265358979);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const double radius = radius_dist(rng);
+            const double angle = angle_dist(rng);
+            const double speed = std::sqrt(PhysicsSystem::GRAVITY * central_mass / radius);
+            const Entity ent = ecs.createEntity();
+            ecs.addComponent<Position>(
+                ent, Position{{radius * std::cos(angle), radius * std::sin(angle)}});
+            ecs.addComponent<Velocity>(
+                ent, Velocity{{-speed * std::sin(angle), speed * std::cos(angle)}});
+            if (mass > 0.0)
+            {
+                ecs.addComponent<Mass>(ent, Mass{mass});
+            }
+            else
+            {
+                ecs.addComponent<Tracer>(ent, Tracer{});
+            }
+        }
+    };
+
 //    create_ent({}, {}, 170);
 //    create_ent({90, 0}, {0, -60}, 15);
 //    create_ent({-120, 0}, {0, 90}, 2);
 
-    create_ent({}, {}, 500);
+    // the central mass is pinned, so its field is baked once instead of summed every step;
+    // a single source is not baked by default
+    physic_sys->getStaticField().setMinBakedSources(1);
+    const Entity star = ecs.createEntity();
+    ecs.addComponent<Position>(star, Position{{0.0, 0.0}});
+    ecs.addComponent<Mass>(star, Mass{500.0});
+    ecs.addComponent<Static>(star, Static{});
     create_ent({100, 0}, {0, -120}, 3);
     create_ent({-50, 0}, {40, 150}, 1);
     create_ent({50, 0}, {40, 0150}, 1);
@@ -154,6 +1383,149 @@ int main()
     axis.emplace_back(sf::Vector2f{AXIS_LENGTH, 0.f}, sf::Color::Red);
     axis.emplace_back(sf::Vector2f{0.f, -AXIS_LENGTH}, sf::Color::Green);
     axis.emplace_back(sf::Vector2f{0.f, AXIS_LENGTH}, sf::Color::Green);
+
+    // Everything below that touches the ECS or the physics runs on the simulation thread;
+    // key presses reach it as commands.
+    CommandQueue commands;
+    // steps per simulated second; lower rates cost proportionally less and interpolation keeps
+    // the motion smooth
+    constexpr double STEP_RATES[] = {600.0, 120.0, 60.0, 30.0};
+    std::size_t step_rate = 0;
+    double delta_time = 1.0 / STEP_RATES[step_rate];
+    const auto handle_key = [&](sf::Keyboard::Key key) {
+        if (key == sf::Keyboard::B)
+        {
+            const auto next = static_cast<GravitySolver>(
+                ((int)physic_sys->getSolver() + 1) % 3);
+            physic_sys->setAutoTune(false);
+            physic_sys->setSolver(next);
+            std::cout << toString(physic_sys->getSolver()) << " gravity, error "
+                      << physic_sys->measureSolverError() << std::endl;
+        }
+        if (key == sf::Keyboard::P)
+        {
+            physic_sys->reportScaling(std::cout);
+        }
+        if (key == sf::Keyboard::T)
+        {
+            const Gravity::BlockTimestepper::Stats &stats =
+                physic_sys->getBlockTimestepper().getStats();
+            const bool enable = !physic_sys->isBlockTimesteps();
+            physic_sys->setBlockTimesteps(enable);
+            std::cout << "block timesteps " << (enable ? "on" : "off")
+                      << ", last step " << stats.body_updates << " body updates vs "
+                      << stats.shared_step_updates << " with a shared step" << std::endl;
+        }
+        if (key == sf::Keyboard::R)
+        {
+            constexpr std::size_t TRACER_BATCH = 10000;
+            create_disc(TRACER_BATCH, 500.0, 0.0);
+        }
+        if (key == sf::Keyboard::G)
+        {
+            constexpr std::size_t BODY_BATCH = 2000;
+            create_disc(BODY_BATCH, 500.0, 0.05);
+        }
+        if (key == sf::Keyboard::M)
+        {
+            physic_sys->reportPrecision(std::cout);
+            Gravity::DirectSolver &direct = physic_sys->getDirectSolver();
+            direct.setPrecision(direct.getPrecision() == Gravity::Precision::Double
+                    ? Gravity::Precision::Mixed
+                    : Gravity::Precision::Double);
+            std::cout << toString(direct.getPrecision()) << " precision" << std::endl;
+        }
+        if (key == sf::Keyboard::C)
+        {
+            const bool enable = !physic_sys->isMergeOnCollision();
+            physic_sys->setMergeOnCollision(enable);
+            std::cout << "collision merging " << (enable ? "on" : "off") << std::endl;
+        }
+        if (key == sf::Keyboard::K)
+        {
+            const auto next = static_cast<ShortRangeForce>(
+                ((int)physic_sys->getShortRangeForce() + 1) % 4);
+            physic_sys->setShortRangeForce(next);
+            std::cout << toString(next) << " short-range force" << std::endl;
+        }
+        if (key == sf::Keyboard::U)
+        {
+            const bool enable = !physic_sys->isAutoTune();
+            physic_sys->setAutoTune(enable);
+            std::cout << "solver autotuning " << (enable ? "on" : "off") << std::endl;
+        }
+        if (key == sf::Keyboard::I)
+        {
+            const auto next = static_cast<Gravity::Integrator>(
+                ((int)physic_sys->getIntegrator() + 1) % 3);
+            physic_sys->setIntegrator(next);
+            std::cout << toString(next) << " integrator" << std::endl;
+        }
+        if (key == sf::Keyboard::H)
+        {
+            step_rate = (step_rate + 1) % std::size(STEP_RATES);
+            delta_time = 1.0 / STEP_RATES[step_rate];
+            std::cout << "stepping at " << STEP_RATES[step_rate] << " Hz" << std::endl;
+        }
+    };
+
+    // Frames are drawn on the render pool.
+    Parallel::ThreadPool render_pool(std::max(1u, std::thread::hardware_concurrency() / 2));
+    // The static field is baked in the background on the render pool, which must outlive
+    // every bake.
+    physic_sys->getStaticField().setBakePool(&render_pool);
+
+    // The simulation steps on its own thread at a fixed time step, paced by the wall clock
+    // while Space is held. Each wake-up runs every step that is due and the pending commands,
+    // then publishes one snapshot for the batch, however many steps it ran.
+    // The window thread draws the newest snapshot at its own rate, on its own thread pool, so
+    // neither thread waits for the other; a slow step only slows the simulation down.
+    Parallel::TripleBuffer<RenderSnapshot> snapshots;
+    std::atomic<bool> running{true};
+    std::atomic<bool> simulating{false};
+    std::thread simulation([&]() {
+        using Clock = std::chrono::steady_clock;
+        // wall-clock time the simulation may fall behind before the rest is dropped
+        constexpr double MAX_LAG = 0.1;
+        SnapshotWriter writer;
+        double lag = 0.0;
+        Clock::time_point last = Clock::now();
+        bool changed = true;
+        while (running.load(std::memory_order_relaxed))
+        {
+            changed = commands.runPending() || changed;
+            const Clock::time_point now = Clock::now();
+            const double elapsed = std::chrono::duration<double>(now - last).count();
+            last = now;
+            lag = simulating.load(std::memory_order_relaxed) ? std::min(lag + elapsed, MAX_LAG)
+                                                             : 0.0;
+            double step = 0.0;
+            while (lag >= delta_time)
+            {
+                const bool was_tuning = physic_sys->isTuning();
+                physic_sys->update(delta_time);
+                lag -= delta_time;
+                step += delta_time;
+                changed = true;
+                if (was_tuning && !physic_sys->isTuning())
+                {
+                    physic_sys->reportTuning(std::cout);
+                }
+            }
+            if (changed)
+            {
+                writer.capture(snapshots.getWriteBuffer(), step);
+                snapshots.publish();
+                changed = false;
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    });
+
+    const Parallel::ThreadPoolScope render_scope(render_pool);
     while (window.isOpen())
     {
         sf::Event event;
@@ -169,6 +1541,8 @@ int main()
                 {
                     window.close();
                 }
+                const sf::Keyboard::Key key = event.key.code;
+                commands.post([&handle_key, key]() { handle_key(key); });
             }
         }
 
@@ -197,23 +1571,21 @@ int main()
 
         /////////////////////////////////////////////////////
 
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Space))
+        simulating.store(sf::Keyboard::isKeyPressed(sf::Keyboard::Space));
+        if (snapshots.update())
         {
-            constexpr int REPEATS = 10;
-            constexpr double DELTA_TIME = 1.0 / 60.0 / (double)REPEATS;
-
-            for (int i = 0; i < REPEATS; ++i)
-            {
-                physic_sys->update(DELTA_TIME);
-                render_sys->updateTrails();
-            }
+            render_sys.setSnapshot(snapshots.getReadBuffer());
         }
 
         window.clear();
         window.draw(axis.data(), 4, sf::Lines);
-        window.draw(*render_sys);
+        window.draw(render_sys);
         window.display();
     }
 
+    running.store(false);
+    simulation.join();
+    // waits for a bake still using the render pool
+    physic_sys->getStaticField().setBakePool(nullptr);
     return 0;
 }